@@ -7,27 +7,37 @@
 #include <MMU.h>
 #include <PLIC.h>
 #include <UART.h>
+#include <VirtioConsole.h>
 
 class Bus {
 public:
     Bus(uint64_t mem_size)
         : ram_size(mem_size)
     {
+        mmu = new MMU(ram_size);
 #ifndef FUZZ_ENV
-        devices = std::vector<Device*> { new CLINT(), new PLIC(), new UART() };
+        clint = new CLINT();
+        plic = new PLIC();
+        console = new VirtioConsole(mmu);
+        devices = std::vector<Device*> { clint, plic, new UART(), console };
+        for (Device* device : devices)
+            device->attach(&irqs);
 #endif
-        mmu = new MMU(ram_size);
     }
 
     Bus(const Bus& other)
     {
+        mmu = new MMU(*other.mmu);
 #ifndef FUZZ_ENV
-        devices
-            = std::vector<Device*> { new CLINT(*dynamic_cast<CLINT*>(other.devices[0])),
-                                     new PLIC(*dynamic_cast<PLIC*>(other.devices[1])),
-                                     new UART(*dynamic_cast<UART*>(other.devices[2])) };
+        clint = new CLINT(*other.clint);
+        plic = new PLIC(*other.plic);
+        console = new VirtioConsole(*other.console, mmu);
+        devices = std::vector<Device*> {
+            clint, plic, new UART(*dynamic_cast<UART*>(other.devices[2])), console
+        };
+        for (Device* device : devices)
+            device->attach(&irqs);
 #endif
-        mmu = new MMU(*other.mmu);
     }
 
     ~Bus()
@@ -41,19 +51,29 @@ public:
 
     std::pair<uint64_t, ReturnException> load(uint64_t, size_t);
     ReturnException store(uint64_t, uint64_t, size_t);
-    bool uart_is_interrupting() { return get_uart()->is_interrupting(); }
+    void poll_interrupts();
+    /* Blocks until a device requests an interrupt or `deadline` passes. */
+    void wait_for_interrupt(std::chrono::steady_clock::time_point deadline)
+    {
+        irqs.wait_until(deadline);
+    }
+
+    void save(SnapshotWriter&) const;
+    bool restore(SnapshotReader&);
+    void reset_to(const Bus& other);
 
     MMU* get_mmu() const { return mmu; }
+    PLIC* get_plic() const { return plic; }
+    CLINT* get_clint() const { return clint; }
+    VirtioConsole* get_console() const { return console; }
 
 private:
     std::vector<Device*> devices;
-    Device* get_uart() const
-    {
-        return *std::find_if(std::begin(devices), std::end(devices), [](Device* device) {
-            return dynamic_cast<UART*>(device) != nullptr;
-        });
-    }
 
     uint64_t ram_size;
     MMU* mmu;
+    PLIC* plic = nullptr;
+    CLINT* clint = nullptr;
+    VirtioConsole* console = nullptr;
+    PendingIrqs irqs;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -7,6 +8,10 @@
 #include <Device.h>
 #include <defs.h>
 
+/*
+ * mtime counts at CLINT_TIMEBASE_FREQ and follows the host's monotonic clock,
+ * so a hart parked in WFI can sleep until mtimecmp instead of spinning.
+ */
 class CLINT : public Device {
 public:
     CLINT();
@@ -19,12 +24,26 @@ public:
 
     [[nodiscard]] uint64_t get_size() const override { return CLINT_SIZE; }
 
-    [[nodiscard]] bool is_interrupting() override { return false; }
+    void save(SnapshotWriter&) const override;
+    void restore(SnapshotReader&) override;
+
+    /* Whether the guest programmed a compare value at all. */
+    [[nodiscard]] bool timer_armed() const { return mtimecmp != NEVER; }
+    [[nodiscard]] bool timer_pending() const { return load_mtime() >= mtimecmp; }
+    /* The host time at which mtime reaches mtimecmp. */
+    [[nodiscard]] std::chrono::steady_clock::time_point timer_deadline() const;
 
 private:
+    static constexpr uint64_t NEVER = ~0ULL;
+    using Ticks = std::chrono::duration<int64_t, std::ratio<1, CLINT_TIMEBASE_FREQ>>;
+
     [[nodiscard]] uint64_t load64(uint64_t addr) const;
     void store64(uint64_t addr, uint64_t data);
 
-    uint64_t mtime;
+    [[nodiscard]] uint64_t load_mtime() const;
+    void store_mtime(uint64_t);
+
+    /* Host time at which mtime read zero. */
+    std::chrono::steady_clock::time_point epoch;
     uint64_t mtimecmp;
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/*
+ * Operands of the comparisons a run executed, one slot per comparison site.
+ * Clearing bumps a generation number instead of wiping the table, so a run
+ * only pays for the sites it reaches.
+ */
+class CmpLog {
+public:
+    static constexpr uint32_t SLOTS = 1024;
+
+    struct Entry {
+        uint64_t op1;
+        uint64_t op2;
+        uint64_t gen;
+    };
+
+    void clear()
+    {
+        gen++;
+        n_used = 0;
+    }
+
+    void record(uint64_t pc, uint64_t op1, uint64_t op2)
+    {
+        /* Operands that already match have nothing left to solve. */
+        if (op1 == op2)
+            return;
+
+        auto slot = static_cast<uint32_t>((pc >> 2) & (SLOTS - 1));
+        Entry& e = entries[slot];
+        if (e.gen != gen) {
+            e.gen = gen;
+            used[n_used++] = slot;
+        }
+        e.op1 = op1;
+        e.op2 = op2;
+    }
+
+    [[nodiscard]] uint32_t size() const { return n_used; }
+
+    [[nodiscard]] const Entry& operator[](uint32_t i) const { return entries[used[i]]; }
+
+private:
+    std::array<Entry, SLOTS> entries {};
+    /* Slots written since the last clear(), in the order they were first hit. */
+    std::array<uint32_t, SLOTS> used {};
+    uint32_t n_used = 0;
+    uint64_t gen = 1;
+};
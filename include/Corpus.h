@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Fuzz inputs of any format. Loading a corpus directory only lists it, every
+ * file is mapped the first time it is picked. Entries are immutable and only
+ * ever appended; the storage is reserved up front so readers index it
+ * without locking, while appends are serialized among themselves.
+ */
+class Corpus {
+public:
+    /* Compact per-entry metadata, fields stay zero until they are known. */
+    struct Entry {
+        std::atomic<const char*> data;
+        std::atomic<uint64_t> size;
+        /* Instructions retired by the run that found the entry. */
+        std::atomic<uint64_t> exec_insns;
+        /* Coverage map bytes the entry was first to reach. */
+        std::atomic<uint32_t> new_edges;
+    };
+
+    static constexpr size_t MAX_ENTRIES = 1 << 20;
+
+    explicit Corpus(const std::string& dir_path);
+
+    [[nodiscard]] size_t size() const
+    {
+        return n_entries.load(std::memory_order_acquire);
+    }
+    [[nodiscard]] size_t random_index() const;
+    /* The bytes of entry `idx`, mapped on first use. */
+    [[nodiscard]] std::string_view get(size_t idx) const;
+    [[nodiscard]] const Entry& meta(size_t idx) const { return entries[idx]; }
+    [[nodiscard]] const std::string& path(size_t idx) const { return paths[idx]; }
+
+    /* Saves `data` into the corpus directory and appends it as a new entry. */
+    void promote(std::string_view data, uint64_t exec_insns, uint32_t new_edges);
+
+private:
+    const char* map(size_t idx) const;
+    void append(std::string path, const char* data, uint64_t len, uint64_t exec_insns,
+                uint32_t new_edges);
+
+    std::string dir;
+    std::vector<std::string> paths;
+    /* Entry has a trivial constructor, untouched slots cost no memory. */
+    std::unique_ptr<Entry[]> entries;
+    std::atomic<size_t> n_entries { 0 };
+    std::mutex append_lock;
+    uint64_t next_id = 0;
+};
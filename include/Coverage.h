@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+static constexpr size_t COVERAGE_MAP_SIZE = 1 << 16;
+
+/*
+ * AFL-style edge hit counts of a single run. An edge is hashed from the
+ * addresses of the control transfer and its destination, collisions are
+ * accepted in exchange for a fixed, cache-friendly map.
+ */
+class CoverageMap {
+public:
+    CoverageMap() { clear(); }
+
+    void hit_edge(uint64_t from, uint64_t to)
+    {
+        uint64_t idx = (scramble(from) ^ (scramble(to) >> 1)) & (COVERAGE_MAP_SIZE - 1);
+        /* NeverZero: a count wrapping at 256 skips 0, so the edge stays covered. */
+        uint8_t& count = map[idx];
+        count = static_cast<uint8_t>(count + 1 + (count == 255));
+    }
+
+    void clear() { map.fill(0); }
+
+    /* Folds hit counts into AFL's power-of-two buckets, in place. */
+    void classify();
+    /* Identifies a classified map, runs with equal hashes covered the same. */
+    [[nodiscard]] uint64_t hash() const;
+
+    [[nodiscard]] const uint8_t* data() const { return map.data(); }
+
+private:
+    /* Instructions are 4-byte aligned, the low bits carry no information. */
+    static uint64_t scramble(uint64_t addr)
+    {
+        return (addr >> 2) * 0x9E3779B97F4A7C15ULL >> 48;
+    }
+
+    alignas(64) std::array<uint8_t, COVERAGE_MAP_SIZE> map;
+};
+
+/*
+ * The (edge, bucket) pairs no run has produced yet, a set bit means unseen.
+ * Comparing a run against it is a linear pass over both maps, done 16 bytes
+ * at a time where SSE2 is available.
+ */
+class VirginMap {
+public:
+    VirginMap() { map.fill(0xFF); }
+
+    /* Clears the bits `trace` covers, returns how many map bytes had new ones. */
+    uint32_t merge(const CoverageMap& trace);
+
+    [[nodiscard]] uint64_t edges_found() const;
+
+private:
+    alignas(64) std::array<uint8_t, COVERAGE_MAP_SIZE> map;
+};
+
+/*
+ * Coverage shared by all workers. Each worker filters its runs through a
+ * private VirginMap first, only the rare runs that are new to it take the lock
+ * to check against the global map.
+ */
+class SharedCoverage {
+public:
+    uint32_t merge(const CoverageMap& trace)
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        return virgin.merge(trace);
+    }
+
+    [[nodiscard]] uint64_t edges_found()
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        return virgin.edges_found();
+    }
+
+private:
+    std::mutex mu;
+    VirginMap virgin;
+};
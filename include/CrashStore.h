@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "VEmu.h"
+
+/*
+ * Crashes bucketed by where the guest stopped and the return addresses
+ * leading there. Timeouts stop wherever the instruction limit happens to
+ * fall, so they are bucketed by the return addresses alone, and only the
+ * first MAX_TIMEOUTS are kept. The first input of every bucket is saved as
+ * a reproduction bundle, a directory holding the input and an info file that
+ * points at a snapshot of the machine the run started from. Repeats of a
+ * bucket are dropped.
+ */
+class CrashStore {
+public:
+    enum class Kind {
+        Crash,
+        Timeout,
+    };
+
+    struct Report {
+        Kind kind;
+        VEmu::StopSite site;
+        ReturnException fault;
+        uint64_t instructions;
+        /* Console output of the run, saved along if not empty. */
+        std::string output;
+    };
+
+    explicit CrashStore(std::string _dir);
+
+    /* Identifies the bucket of a report, workers filter repeats by it themselves. */
+    static uint64_t bucket(const Report& r);
+    /*
+     * Saves `input` unless its bucket was seen already, `golden` is the
+     * machine the run started from. Returns whether the bucket was new.
+     */
+    bool add(const Report& r, std::string_view input, VEmu& golden);
+
+    [[nodiscard]] uint64_t unique_crashes() const
+    {
+        return n_crashes.load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] uint64_t unique_timeouts() const
+    {
+        return n_timeouts.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr const char* SNAPSHOT_NAME = "start.snap";
+    static constexpr uint64_t MAX_TIMEOUTS = 64;
+
+    bool write_bundle(const Report& r, std::string_view input);
+
+    std::string dir;
+    std::mutex lock;
+    std::unordered_set<uint64_t> buckets;
+    /* Every worker starts from the same state, one snapshot serves all bundles. */
+    bool snapshot_saved = false;
+    std::atomic<uint64_t> n_crashes { 0 };
+    std::atomic<uint64_t> n_timeouts { 0 };
+
+#ifdef TEST_ENV
+    /* The unit tests fill the store up to its cap. */
+    friend class Tester;
+#endif
+};
@@ -1,17 +1,85 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
 #include <utility>
 
+#include <Snapshot.h>
 #include <defs.h>
 
+/*
+ * The interrupt requests of the devices towards one hart, one bit per PLIC
+ * source. Any device thread sets its bit with a single atomic OR, and the hart
+ * collects them all with one load. A hart parked in WFI sleeps here until a bit
+ * is set or its deadline passes.
+ */
+class PendingIrqs {
+public:
+    static constexpr uint32_t IRQS_NUM = 64;
+
+    void raise(uint32_t irq)
+    {
+        assert(irq < IRQS_NUM);
+        pending.fetch_or(1ULL << irq, std::memory_order_release);
+        /* Taking the lock orders the notification after a sleeper's check. */
+        { std::lock_guard<std::mutex> lock(mu); }
+        cv.notify_all();
+    }
+
+    /* Returns and clears the pending requests, a plain load when there are none. */
+    uint64_t take()
+    {
+        if (pending.load(std::memory_order_relaxed) == 0)
+            return 0;
+        return pending.exchange(0, std::memory_order_acquire);
+    }
+
+    void wait_until(std::chrono::steady_clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait_until(lock, deadline,
+                      [this] { return pending.load(std::memory_order_relaxed) != 0; });
+    }
+
+private:
+    std::atomic<uint64_t> pending { 0 };
+    std::mutex mu;
+    std::condition_variable cv;
+};
+
 class Device {
 public:
+    Device() = default;
+    /* A copy belongs to another machine, which attaches its own hart. */
+    Device(const Device&) { }
+
     virtual std::pair<uint64_t, ReturnException> load(uint64_t, size_t) = 0;
     virtual ReturnException store(uint64_t, uint64_t, size_t) = 0;
     [[nodiscard]] virtual uint64_t get_base() const = 0;
     [[nodiscard]] virtual uint64_t get_size() const = 0;
 
-    virtual bool is_interrupting() = 0;
+    /* The PLIC source the device is wired to, zero if it raises no interrupts. */
+    [[nodiscard]] virtual uint32_t get_irq() const { return 0; }
+
+    virtual void save(SnapshotWriter&) const = 0;
+    virtual void restore(SnapshotReader&) = 0;
     virtual ~Device() = default;
+
+    void attach(PendingIrqs* p) { irqs.store(p, std::memory_order_release); }
+
+protected:
+    /* Requests the device's interrupt, waking the hart if it is parked in WFI. */
+    void raise_irq()
+    {
+        PendingIrqs* p = irqs.load(std::memory_order_acquire);
+        if (p != nullptr)
+            p->raise(get_irq());
+    }
+
+private:
+    std::atomic<PendingIrqs*> irqs { nullptr };
 };
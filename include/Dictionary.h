@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+/*
+ * Mutation tokens taken from the target itself: NUL-terminated printable
+ * strings in its loaded segments, and the constants its code compares
+ * against. Constants are given in both byte orders.
+ */
+std::vector<std::string> extract_dictionary(const FileInfo* info);
@@ -13,7 +13,8 @@ public:
     void store_reg(size_t idx, double value);
     double load_reg(size_t idx);
     void dump_regs();
-    std::array<double, 32> get_regs();
+    std::array<double, 32> get_regs() const;
+    void set_regs(const std::array<double, REGS_NUM>& regs);
 
 private:
     std::array<double, REGS_NUM> data;
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Host files the guests open, mapped read-only and paged in on first touch.
+ * Mappings are cached by pathname and shared by every emulator in the
+ * process, each open just checks the file is unchanged on disk. The contents
+ * stay mapped while any guest still holds them.
+ */
+class FileCache {
+public:
+    struct MappedFile {
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        const char* data = nullptr;
+        uint64_t len = 0;
+        /* Identifies the version of the file the mapping was taken from. */
+        dev_t dev = 0;
+        ino_t ino = 0;
+        timespec mtime {};
+    };
+
+    static FileCache& the();
+
+    /*
+     * The contents of `pathname`, nullptr with errno set if the host open
+     * fails. The host file is only ever opened for reading.
+     */
+    std::shared_ptr<const MappedFile> open(const std::string& pathname);
+
+private:
+    FileCache() = default;
+
+    static std::shared_ptr<const MappedFile> map(int fd);
+
+    std::mutex lock;
+    std::unordered_map<std::string, std::shared_ptr<const MappedFile>> files;
+};
@@ -1,24 +1,141 @@
 #pragma once
 
+#include "Corpus.h"
+#include "Coverage.h"
+#include "CrashStore.h"
+#include "Mutator.h"
+#include "Scheduler.h"
+#include "Taint.h"
 #include "VEmu.h"
 #include "util.h"
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-struct stats {
-    uint64_t runs;
-    uint64_t crashes;
+/*
+ * Counters of a single worker. Only the owning thread writes them, so relaxed
+ * increments suffice and a reporter may sum them across workers at any time.
+ * The alignment keeps workers from sharing cache lines.
+ */
+struct alignas(64) stats {
+    std::atomic<uint64_t> runs { 0 };
+    std::atomic<uint64_t> instructions { 0 };
+    std::atomic<uint64_t> crashes { 0 };
+    std::atomic<uint64_t> timeouts { 0 };
+    std::atomic<uint64_t> new_inputs { 0 };
+};
+
+/* Settings shared by all workers. */
+struct FuzzConfig {
+    /* nullptr runs the target without instrumentation. */
+    SharedCoverage* coverage = nullptr;
+    /* Runs longer than this are cut off as timeouts. */
+    uint64_t insn_limit = ~0ULL;
+    /*
+     * Entry of the function fuzzed in persistent mode, all ones to run the
+     * whole program instead. The function gets the input buffer in a0 and its
+     * length in a1, every run ends when it returns.
+     */
+    uint64_t persistent_addr = ~0ULL;
+    /* Feeds comparison operands of each run back into the mutator. */
+    bool cmplog = false;
+    /* nullptr picks corpus entries uniformly, one per run. */
+    Scheduler* scheduler = nullptr;
+    /* nullptr drops the inputs that crash or hang the target. */
+    CrashStore* crashes = nullptr;
+    /* Tokens the mutator splices into inputs, nullptr for none. */
+    const std::vector<std::string>* dictionary = nullptr;
+    /*
+     * Runs every entry once with taint tracking, the first time a worker
+     * picks it, and aims byte mutations at the offsets reaching branches.
+     */
+    bool taint = false;
+    /*
+     * Guest stdout and stderr are discarded, passed on to the host's in
+     * batches, or captured: the tail of every run is kept for get_output()
+     * and crash bundles.
+     */
+    enum class Output {
+        Discard,
+        Host,
+        Capture,
+    };
+    Output output = Output::Discard;
 };
 
 class FuzzThread {
 public:
-    FuzzThread(Corpus* _corpus, FileInfo* _target, const char** _fuzz_opts, int _n_opts);
+    FuzzThread(Corpus* _corpus, FileInfo* _target, const char** _fuzz_opts, int _n_opts,
+               uint64_t _seed, const FuzzConfig& _config);
+
+    static constexpr uint32_t CRASH_EXIT_CODE = VEmu::CRASH_EXIT_CODE;
 
     void dispatch(uint64_t runs);
+    [[nodiscard]] const stats& get_stats() const { return st; }
+
+    /*
+     * Runs `input` once from the snapshot and returns the guest's exit code.
+     * With coverage on, the classified trace is left in get_trace().
+     */
+    uint32_t execute(std::string_view input);
+    [[nodiscard]] const CoverageMap& get_trace() const { return trace; }
+    [[nodiscard]] bool timed_out() const { return emulator->timed_out(); }
+    /* The console output of the last run, empty unless it is captured. */
+    [[nodiscard]] std::string get_output() const;
 
 private:
-    VEmu emulator;
+    /* What "{}" expands to, the target finds the current input under it. */
+    static constexpr const char* INPUT_PATH = "/fuzz/input";
+    static constexpr uint64_t SPLICE_CHANCE = 16;
+    /* Planted as the return address in persistent mode, nothing is mapped there. */
+    static constexpr uint64_t RETURN_ADDR = ~0xFFFULL;
+    static constexpr uint64_t CAPTURE_SIZE = 1 << 16;
+
+    void pick_entry();
+    void finish_entry();
+    void analyse_taint();
+    void prepare_input();
+    uint32_t run_persistent(std::string_view input);
+    void update_coverage();
+    void save_crash(CrashStore::Kind kind);
+
     Corpus* corpus;
     FileInfo* target;
     const char** fuzz_opts;
     int n_opts;
+    uint64_t seed;
+    FuzzConfig config;
+    /*
+     * The target stopped right before main, or before the persistent function,
+     * every run starts over from it.
+     */
+    std::unique_ptr<VEmu> golden;
+    std::unique_ptr<VEmu> emulator;
+    /* Guest address of the input in persistent mode. */
+    uint64_t input_addr = 0;
+    SharedCoverage* shared_coverage;
+    Mutator mutator;
+    /* The entry being fuzzed, how many runs it has left and what they did. */
+    size_t current = 0;
+    uint64_t energy = 0;
+    uint64_t current_execs = 0;
+    uint64_t current_insns = 0;
+    uint64_t current_finds = 0;
+    CoverageMap trace;
+    VirginMap virgin;
+    CmpLog cmplog;
+    /* A capture serves both streams, so their output stays interleaved. */
+    std::optional<OutputSink> stdout_sink;
+    std::optional<OutputSink> stderr_sink;
+    TaintTracker tracker { INPUT_PATH };
+    /* Hot offsets of the entries this worker has analysed. */
+    std::unordered_map<size_t, std::vector<uint32_t>> hot_offsets;
+    /* Buckets this worker has reported, repeats never reach the shared store. */
+    std::unordered_set<uint64_t> seen_buckets;
+    stats st;
 };
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+ * Host writes shared by every emulator in the process. Writes are queued and
+ * handed to the kernel in batches through one io_uring, one syscall per batch
+ * instead of one per write. Each batch is linked, so it lands in queue order.
+ * Without io_uring, or once it fails, writes are done synchronously.
+ */
+class IoRing {
+public:
+    static IoRing& the();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+    ~IoRing();
+
+    /* Queues `data` for `fd` at its current position. */
+    void write(int fd, std::vector<uint8_t> data);
+    /* Returns once everything queued so far has been written. */
+    void drain();
+
+    [[nodiscard]] bool has_ring() const { return ring_fd != -1; }
+
+private:
+    static constexpr unsigned RING_ENTRIES = 32;
+    /* Batches are submitted when this many writes are queued, or on drain(). */
+    static constexpr size_t BATCH_SIZE = 8;
+    /* Marks a write whose completion has not been seen, no cqe.res is this low. */
+    static constexpr int64_t RESULT_PENDING = INT64_MIN;
+
+    IoRing();
+
+    struct Request {
+        int fd;
+        std::vector<uint8_t> data;
+    };
+
+    bool setup();
+    void submit_locked();
+    bool submit_ring();
+    void strand_in_flight(unsigned submitted);
+    static void write_sync(int fd, const uint8_t* data, uint64_t len);
+
+    std::mutex lock;
+    std::vector<Request> queue;
+    std::vector<int64_t> results;
+    /* Buffers the kernel may still read, kept for the life of the process. */
+    std::vector<std::vector<uint8_t>> stranded;
+
+    int ring_fd = -1;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    uint64_t sq_ring_size = 0;
+    uint64_t cq_ring_size = 0;
+    void* sqes = nullptr;
+    uint64_t sqes_size = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    void* cqes = nullptr;
+    unsigned sq_entries = 0;
+};
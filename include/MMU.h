@@ -1,7 +1,6 @@
 #pragma once
 
 #include <iostream>
-#include <unordered_set>
 #include <vector>
 
 #include <Device.h>
@@ -14,53 +13,127 @@ static constexpr BytePermission PERM_READ = (1 << 2);
 static constexpr BytePermission PERM_RAW = (1 << 3);
 
 static constexpr uint64_t BLOCK_SIZE = 4096;
+static constexpr uint64_t GUEST_PAGE_SIZE = 4096;
 
 class MMU : public Device {
 public:
-    MMU(const MMU& other)
-    {
-        ram = other.ram;
-        byte_permission = other.byte_permission;
-        dirty_blocks = other.dirty_blocks;
-        alloc_ptr = other.alloc_ptr;
-        ram_size = other.ram_size;
-    }
+    MMU(const MMU& other);
+    MMU& operator=(const MMU&) = delete;
 
     MMU(uint64_t ram_size);
+    ~MMU() override;
     [[nodiscard]] std::pair<uint64_t, ReturnException> load(uint64_t, size_t) override;
     ReturnException store(uint64_t, uint64_t, size_t) override;
     [[nodiscard]] uint64_t get_base() const override { return 0; }
     [[nodiscard]] uint64_t get_size() const override { return ram_size; }
-    [[nodiscard]] bool is_interrupting() override { return false; }
-    void write_from(const std::vector<uint8_t>&, uint64_t);
+    void save(SnapshotWriter&) const override;
+    void restore(SnapshotReader&) override;
+    bool save_sections(int fd, uint64_t ram_offset, uint64_t perms_offset) const;
+    bool map_sections(int fd, uint64_t ram_offset, uint64_t perms_offset,
+                      uint64_t mem_size);
+
+    ReturnException write_from(const std::vector<uint8_t>&, uint64_t);
+    ReturnException write_from(const uint8_t* src, uint64_t len, uint64_t start_addr);
     [[nodiscard]] std::pair<std::vector<uint8_t>, ReturnException>
-        read_to(uint64_t, uint64_t) const;
+        read_to(uint64_t, uint64_t);
     [[nodiscard]] uint64_t cur_alloc_ptr() const { return alloc_ptr; }
-    [[nodiscard]] std::string _read_null_terminated_string(uint64_t) const;
-    [[nodiscard]] std::pair<uint32_t, ReturnException> load_insn(uint64_t addr) const;
+    [[nodiscard]] std::string _read_null_terminated_string(uint64_t);
+    [[nodiscard]] std::pair<uint32_t, ReturnException> load_insn(uint64_t addr);
+
+    /*
+     * Direct accessors for device DMA, these bypass the permission checks.
+     * They fail without touching memory if the range is not all in RAM.
+     */
+    [[nodiscard]] bool in_ram(uint64_t addr, uint64_t len) const
+    {
+        return len <= ram_size && addr <= ram_size - len;
+    }
+    [[nodiscard]] bool dma_read(uint64_t, uint8_t*, uint64_t) const;
+    [[nodiscard]] bool dma_write(uint64_t, const uint8_t*, uint64_t);
 
+    /* Rolls back every block written since the last reset to its state in `other`. */
     void reset_to(const MMU& other);
 
     uint64_t allocate(uint64_t);
     void set_perms(uint64_t, uint64_t, BytePermission);
 
+    /*
+     * Moves the end of the heap, what brk() sets. The heap may shrink back to
+     * where the host's own allocations end and grow up to the lowest mapping.
+     */
+    bool set_break(uint64_t addr);
+    /*
+     * Page-granular mappings between the heap and the top of RAM, handed out
+     * top-down from a free page map. A mapping is only reserved here, its
+     * pages are zeroed and given `perms` on first touch, so large
+     * reservations cost nothing up front. `fixed` maps exactly at `addr`,
+     * replacing what was there. Returns 0 when the pages are not available.
+     */
+    uint64_t map_pages(uint64_t addr, uint64_t len, BytePermission perms, bool fixed);
+    void unmap_pages(uint64_t addr, uint64_t len);
+
+    /*
+     * Shadow memory for taint tracking: every byte gets a label, the offset
+     * of the input byte it came from plus one, or 0. It is only allocated
+     * once enabled, and reset along with the blocks it was written in by the
+     * runs that wrote any.
+     */
+    void enable_labels();
+    [[nodiscard]] bool has_labels() const { return labels != nullptr; }
+    [[nodiscard]] uint32_t get_label(uint64_t addr) const
+    {
+        return addr < ram_size ? labels[addr] : 0;
+    }
+    void set_label(uint64_t addr, uint32_t label)
+    {
+        if (addr < ram_size) {
+            labels[addr] = label;
+            labels_written = true;
+            mark_dirty(addr, 1);
+        }
+    }
+
     void load_file(FileInfo*);
 
 private:
-    [[nodiscard]] std::pair<uint64_t, ReturnException> load_byte(uint64_t) const;
-    [[nodiscard]] std::pair<uint64_t, ReturnException> load_hword(uint64_t) const;
-    [[nodiscard]] std::pair<uint64_t, ReturnException> load_word(uint64_t) const;
-    [[nodiscard]] std::pair<uint64_t, ReturnException> load_dword(uint64_t) const;
+    [[nodiscard]] std::pair<uint64_t, ReturnException> load_byte(uint64_t);
+    [[nodiscard]] std::pair<uint64_t, ReturnException> load_hword(uint64_t);
+    [[nodiscard]] std::pair<uint64_t, ReturnException> load_word(uint64_t);
+    [[nodiscard]] std::pair<uint64_t, ReturnException> load_dword(uint64_t);
 
-    void store_byte(uint64_t, uint64_t);
-    void store_hword(uint64_t, uint64_t);
-    void store_word(uint64_t, uint64_t);
-    void store_dword(uint64_t, uint64_t);
+    ReturnException store_byte(uint64_t, uint64_t);
+    ReturnException store_hword(uint64_t, uint64_t);
+    ReturnException store_word(uint64_t, uint64_t);
+    ReturnException store_dword(uint64_t, uint64_t);
+
+    void mark_dirty(uint64_t addr, uint64_t len);
+    /* Gives the pending pages of the range their zeroes and permissions. */
+    void fault_in(uint64_t addr, uint64_t len)
+    {
+        if (pending_pages != 0)
+            materialize(addr, len);
+    }
+    void materialize(uint64_t addr, uint64_t len);
+    [[nodiscard]] bool pages_free(uint64_t first, uint64_t n) const;
 
 private:
-    std::vector<uint8_t> ram;
-    std::vector<uint8_t> byte_permission;
-    std::unordered_set<uint64_t> dirty_blocks;
+    uint8_t* ram;
+    uint8_t* byte_permission;
+    uint32_t* labels = nullptr;
+    bool labels_written = false;
+    /* A bit per block for the membership test, a list to walk on reset. */
+    std::vector<uint64_t> dirty_bitmap;
+    std::vector<uint64_t> dirty_blocks;
     uint64_t ram_size;
     uint64_t alloc_ptr = 0x10000;
+    /* The heap never shrinks below what the host allocated. */
+    uint64_t heap_start = 0x10000;
+
+    static constexpr uint8_t PAGE_MAPPED = 1 << 4;
+    static constexpr uint8_t PAGE_PENDING = 1 << 5;
+    /* Per page the mapping flags, and the permissions a pending page gets. */
+    std::vector<uint8_t> page_state;
+    uint64_t pending_pages = 0;
+    /* Whether page_state changed since the last reset, which copies it only then. */
+    bool pages_changed = false;
 };
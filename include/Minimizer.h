@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Corpus.h"
+#include "FuzzThread.h"
+
+/*
+ * Corpus distillation (cmin) and input trimming (tmin). Entries are spread
+ * over the workers, each of which keeps reusing its own emulator. Inputs
+ * that crash or hang have no stable coverage and are left out.
+ */
+class Minimizer {
+public:
+    Minimizer(const Corpus* _corpus, std::vector<std::unique_ptr<FuzzThread>>& _workers);
+
+    /* Writes to `out_dir` the smallest set of entries covering what all of them do. */
+    void cmin(const std::string& out_dir);
+    /* Writes every entry to `out_dir`, trimmed as far as its coverage allows. */
+    void tmin(const std::string& out_dir);
+
+private:
+    /* Below this, trimming stops shrinking its block size. */
+    static constexpr uint64_t TRIM_MIN_STEPS = 1024;
+
+    struct signature {
+        uint64_t trace_hash;
+        uint32_t exit_status;
+        bool timed_out;
+
+        bool operator==(const signature& other) const
+        {
+            return trace_hash == other.trace_hash && exit_status == other.exit_status
+                && timed_out == other.timed_out;
+        }
+    };
+
+    /* Calls `fn(worker, idx)` for every entry, on one thread per worker. */
+    void for_each_entry(const std::function<void(FuzzThread&, size_t)>& fn);
+    static signature run(FuzzThread& worker, std::string_view input);
+    /* Shrinks `input` as far as `keeps` accepts, given that it accepts `input`. */
+    static std::string trim(std::string input,
+                            const std::function<bool(std::string_view)>& keeps);
+    bool write_entry(const std::string& out_dir, size_t idx, std::string_view data) const;
+
+    const Corpus* corpus;
+    std::vector<std::unique_ptr<FuzzThread>>& workers;
+
+#ifdef TEST_ENV
+    /* The unit tests trim against a plain predicate. */
+    friend class Tester;
+#endif
+};
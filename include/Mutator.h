@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "CmpLog.h"
+
+/*
+ * Havoc-style mutations of a fuzz input. The input is copied into a buffer
+ * of fixed capacity and mutated in place, so a run allocates nothing and the
+ * next load() undoes every mutation of the previous one.
+ */
+class Mutator {
+public:
+    static constexpr uint64_t MAX_INPUT_SIZE = 1 << 20;
+
+    Mutator();
+
+    /* Makes `data` the input to mutate, it is cut at MAX_INPUT_SIZE. */
+    void load(const char* data, uint64_t len);
+    /* Applies a random stack of mutations. */
+    void havoc();
+    /* Keeps the head of the input and takes the tail from `other`. */
+    void splice(const char* other, uint64_t other_len);
+
+    /* Tokens are stored back to back in a single buffer. */
+    void add_token(const std::string& token);
+    [[nodiscard]] size_t tokens_num() const { return tokens.size(); }
+
+    /*
+     * Operands of comparisons seen in recent runs. One side found in the
+     * input is replaced by the other, otherwise the other is written anywhere.
+     */
+    void set_cmplog(const CmpLog* log) { cmplog = log; }
+
+    /*
+     * Offsets of the loaded input that reach branch conditions, found by
+     * taint analysis. Byte mutations land on them half of the time.
+     */
+    void set_hot_offsets(std::vector<uint32_t> offsets) { hot = std::move(offsets); }
+
+    [[nodiscard]] const char* data() const
+    {
+        return reinterpret_cast<const char*>(buf.get());
+    }
+    [[nodiscard]] uint64_t size() const { return len; }
+
+private:
+    static constexpr uint32_t MAX_STACK_POW2 = 5;
+    static constexpr uint64_t MAX_BLOCK_SIZE = 1024;
+    static constexpr uint32_t ARITH_MAX = 35;
+
+    enum class Op {
+        FlipBit,
+        Interesting8,
+        Interesting16,
+        Interesting32,
+        RandomByte,
+        Arith8,
+        Arith16,
+        Arith32,
+        DeleteBlock,
+        CloneBlock,
+        InsertBlock,
+        OverwriteBlock,
+        OverwriteToken,
+        InsertToken,
+        ReplaceOperand,
+        OpsNum,
+    };
+
+    void apply(Op op);
+    [[nodiscard]] uint64_t random_block_len(uint64_t limit) const;
+    /* Where to write `width` bytes, which must fit in the input. */
+    [[nodiscard]] uint64_t random_pos(uint64_t width) const;
+    /* Opens a gap of `n` bytes at `pos`, returns false when it does not fit. */
+    bool make_room(uint64_t pos, uint64_t n);
+    void erase(uint64_t pos, uint64_t n);
+    void replace_operand();
+
+    template <typename T> void write_int(uint64_t pos, T value);
+    template <typename T> [[nodiscard]] T read_int(uint64_t pos) const;
+
+    std::unique_ptr<uint8_t[]> buf;
+    uint64_t len = 0;
+
+    std::vector<uint8_t> token_bytes;
+    /* Offset and length of each token in `token_bytes`. */
+    std::vector<std::pair<uint32_t, uint32_t>> tokens;
+
+    const CmpLog* cmplog = nullptr;
+    std::vector<uint32_t> hot;
+
+#ifdef TEST_ENV
+    /* The unit tests apply single mutations. */
+    friend class Tester;
+#endif
+};
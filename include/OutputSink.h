@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Where a guest's console output goes: a host descriptor written in large
+ * batches, or a ring buffer holding the last bytes of a run in memory. A VEmu
+ * without a sink discards its output.
+ */
+class OutputSink {
+public:
+    enum class Kind {
+        HostFd,
+        Capture,
+    };
+
+    /* Batches the output for `fd`, which receives it on every flush(). */
+    static OutputSink host_fd(int fd) { return OutputSink(Kind::HostFd, fd, 0); }
+    /* Keeps the last `capacity` bytes written. */
+    static OutputSink capture(uint64_t capacity)
+    {
+        return OutputSink(Kind::Capture, -1, capacity);
+    }
+
+    OutputSink(OutputSink&& other) noexcept;
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+    ~OutputSink();
+
+    void write(const uint8_t* data, uint64_t len);
+    /*
+     * Queues batched output on the IoRing, captures are kept. IoRing::drain()
+     * waits for it to reach the host.
+     */
+    void flush();
+    /* Drops the captured output, e.g. before the next run. */
+    void clear();
+    /* The captured output, oldest byte first. */
+    [[nodiscard]] std::string captured() const;
+
+private:
+    static constexpr uint64_t FLUSH_THRESHOLD = 1 << 16;
+
+    OutputSink(Kind _kind, int _fd, uint64_t capacity);
+
+    Kind kind;
+    int fd;
+    /* Output batched for the host, or the ring of a capture. */
+    std::vector<uint8_t> buf;
+    /* Bytes written to the ring so far, the next one goes at written % size. */
+    uint64_t written = 0;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -7,8 +8,17 @@
 #include <Device.h>
 #include <defs.h>
 
+/*
+ * A platform-level interrupt controller modeled after the RISC-V PLIC
+ * specification. Pending, enable and in-flight state is kept as bitsets so
+ * arbitration walks words rather than individual sources, and a context's
+ * output is only re-evaluated when one of its inputs changes.
+ */
 class PLIC : public Device {
 public:
+    static constexpr uint32_t SOURCES_NUM = 128;
+    static constexpr uint32_t CONTEXTS_NUM = 2;
+
     PLIC();
     PLIC(const PLIC& other) = default;
 
@@ -20,14 +30,33 @@ public:
 
     [[nodiscard]] uint64_t get_size() const override { return PLIC_SIZE; }
 
-    [[nodiscard]] bool is_interrupting() override { return false; }
+    void save(SnapshotWriter&) const override;
+    void restore(SnapshotReader&) override;
+
+    /* Signals an interrupt from source `irq` through its gateway. */
+    void raise(uint32_t irq);
+
+    /* Whether the interrupt line of `context` towards the hart is asserted. */
+    [[nodiscard]] bool is_pending(uint32_t context) const { return eip[context]; }
 
 private:
-    [[nodiscard]] uint64_t load64(uint64_t) const;
-    void store64(uint64_t, uint64_t);
+    static constexpr uint32_t WORDS_NUM = SOURCES_NUM / 64;
+    using Bitset = std::array<uint64_t, WORDS_NUM>;
+
+    [[nodiscard]] uint32_t load32(uint64_t);
+    void store32(uint64_t, uint32_t);
+
+    [[nodiscard]] uint32_t claim(uint32_t context);
+    void complete(uint32_t context, uint32_t irq);
+
+    [[nodiscard]] uint32_t best_candidate(uint32_t context) const;
+    void update(uint32_t context);
+    void update_all();
 
-    uint64_t pending;
-    uint64_t senable;
-    uint64_t spriority;
-    uint64_t sclaim;
+    std::array<uint32_t, SOURCES_NUM> priority;
+    Bitset pending;
+    Bitset in_flight;
+    std::array<Bitset, CONTEXTS_NUM> enable;
+    std::array<uint32_t, CONTEXTS_NUM> threshold;
+    std::array<bool, CONTEXTS_NUM> eip;
 };
@@ -13,7 +13,8 @@ public:
     void store_reg(size_t idx, int64_t value);
     int64_t load_reg(size_t idx);
     void dump_regs();
-    std::array<int64_t, REGS_NUM> get_regs();
+    std::array<int64_t, REGS_NUM> get_regs() const;
+    void set_regs(const std::array<int64_t, REGS_NUM>& regs);
 
 private:
     std::array<int64_t, REGS_NUM> data;
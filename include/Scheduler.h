@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Corpus.h"
+
+/*
+ * Power schedule over the corpus, in the spirit of AFLFast and Entropic.
+ * Every entry gets a weight from its exec speed, size, coverage contribution
+ * and how much fuzzing it already had without paying off. Workers pick an
+ * entry in proportion to its weight through a Fenwick tree, then spend as
+ * many execs on it as its energy allows. The lock is taken once per pick
+ * and once per finished batch, not once per exec.
+ */
+class Scheduler {
+public:
+    explicit Scheduler(const Corpus* _corpus);
+
+    /* Picks an entry, `energy` is set to the number of execs to spend on it. */
+    size_t next(uint64_t& energy);
+    /* Reports a batch of `execs` runs on `idx`, `finds` of which were promoted. */
+    void complete(size_t idx, uint64_t execs, uint64_t insns, uint64_t finds);
+
+private:
+    static constexpr uint64_t BASE_ENERGY = 64;
+    static constexpr uint64_t MAX_ENERGY = 1024;
+    /* Weights are fixed-point, so that the tree holds integers. */
+    static constexpr double WEIGHT_SCALE = 1024.0;
+
+    struct entry_stats {
+        uint64_t execs = 0;
+        uint64_t insns = 0;
+        uint64_t finds = 0;
+        uint64_t weight = 0;
+        /* Instructions per run and bytes, zero while unknown. */
+        double cost = 0;
+        double size = 0;
+    };
+
+    void sync();
+    void update_averages(size_t idx);
+    double score(size_t idx, double& speed, double& rarity) const;
+    void reweigh(size_t idx);
+
+    /* The tree is 1-based, `tree[i]` sums the weights of (i - lowbit(i), i]. */
+    void tree_add(size_t idx, int64_t delta);
+    [[nodiscard]] size_t tree_find(uint64_t target) const;
+
+    const Corpus* corpus;
+    std::mutex mu;
+    std::vector<uint64_t> tree;
+    std::vector<entry_stats> entries;
+    uint64_t total_weight = 0;
+    /* Sums over the entries whose cost or size is known, for the averages. */
+    double sum_cost = 0;
+    uint64_t n_cost = 0;
+    double sum_size = 0;
+    uint64_t n_size = 0;
+
+#ifdef TEST_ENV
+    /* The unit tests check energies against the bounds. */
+    friend class Tester;
+#endif
+};
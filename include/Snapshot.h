@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * On-disk layout of a machine snapshot:
+ *
+ *   SnapshotHeader | machine state | pad | guest RAM | pad | permission shadow
+ *
+ * The RAM and permission sections start on SNAPSHOT_SECTION_ALIGN boundaries so
+ * a restore can map them straight from the file, privately and copy-on-write.
+ */
+static constexpr char SNAPSHOT_MAGIC[8] = { 'V', 'E', 'M', 'U', 'S', 'N', 'A', 'P' };
+static constexpr uint32_t SNAPSHOT_VERSION = 2;
+static constexpr uint64_t SNAPSHOT_SECTION_ALIGN = 0x10000;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t state_offset;
+    uint64_t state_size;
+    uint64_t ram_offset;
+    uint64_t perms_offset;
+    uint64_t ram_size;
+};
+
+class SnapshotWriter {
+public:
+    template <typename T> void put(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value);
+        put_bytes(&value, sizeof(T));
+    }
+
+    void put_bytes(const void* data, uint64_t len)
+    {
+        auto* p = static_cast<const uint8_t*>(data);
+        buf.insert(buf.end(), p, p + len);
+    }
+
+    void put_string(const std::string& s)
+    {
+        put<uint64_t>(s.size());
+        put_bytes(s.data(), s.size());
+    }
+
+    [[nodiscard]] const std::vector<uint8_t>& data() const { return buf; }
+
+private:
+    std::vector<uint8_t> buf;
+};
+
+class SnapshotReader {
+public:
+    SnapshotReader(const uint8_t* data, uint64_t len)
+        : cur(data)
+        , end(data + len)
+    {
+    }
+
+    template <typename T> T get()
+    {
+        static_assert(std::is_trivially_copyable<T>::value);
+        T value {};
+        get_bytes(&value, sizeof(T));
+        return value;
+    }
+
+    /* A short read marks the reader failed, later reads then leave `out` alone. */
+    void get_bytes(void* out, uint64_t len)
+    {
+        if (!has(len)) {
+            fail();
+            return;
+        }
+        memcpy(out, cur, len);
+        cur += len;
+    }
+
+    std::string get_string()
+    {
+        auto len = get<uint64_t>();
+        if (!has(len)) {
+            fail();
+            return {};
+        }
+        std::string s(len, '\0');
+        get_bytes(s.data(), s.size());
+        return s;
+    }
+
+    [[nodiscard]] bool has(uint64_t len) const
+    {
+        return !failed && len <= static_cast<uint64_t>(end - cur);
+    }
+
+    void fail() { failed = true; }
+    [[nodiscard]] bool ok() const { return !failed; }
+
+private:
+    const uint8_t* cur;
+    const uint8_t* end;
+    bool failed = false;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Corpus.h"
+#include "Coverage.h"
+#include "CrashStore.h"
+#include "FuzzThread.h"
+#include "util.h"
+
+/*
+ * Sums the counters of all workers and reports them, as a status line on
+ * stdout and as "key : value" lines in a stats file meant for scripts.
+ * Reading the counters never blocks the workers.
+ */
+class StatsReporter {
+public:
+    StatsReporter(std::string _path, const Corpus* _corpus, SharedCoverage* _coverage,
+                  const CrashStore* _crashes);
+
+    void add_worker(const stats* st) { workers.push_back(st); }
+    void report();
+
+private:
+    struct totals {
+        uint64_t runs = 0;
+        uint64_t instructions = 0;
+        uint64_t crashes = 0;
+        uint64_t timeouts = 0;
+        uint64_t new_inputs = 0;
+    };
+
+    [[nodiscard]] totals sum() const;
+    void write_file(const totals& t, uint64_t edges, double elapsed) const;
+
+    std::string path;
+    const Corpus* corpus;
+    SharedCoverage* coverage;
+    const CrashStore* crashes;
+    std::vector<const stats*> workers;
+
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last_report;
+    totals last;
+};
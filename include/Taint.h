@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/* The input offsets [lo, hi) a value was computed from, empty if lo == hi. */
+struct TaintRange {
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+
+    [[nodiscard]] bool empty() const { return lo >= hi; }
+    /* The smallest range covering both, an approximation of their union. */
+    TaintRange operator|(const TaintRange& other) const
+    {
+        if (empty())
+            return other;
+        if (other.empty())
+            return *this;
+        return { std::min(lo, other.lo), std::max(hi, other.hi) };
+    }
+};
+
+/*
+ * Follows the bytes of one input through a run. Memory carries a label per
+ * byte in the MMU, registers carry the range of input offsets their value was
+ * computed from, and conditional branches on tainted registers are recorded.
+ * Ranges instead of sets keep propagation cheap; a value mixing distant bytes
+ * over-approximates to everything between them.
+ */
+class TaintTracker {
+public:
+    explicit TaintTracker(std::string _source)
+        : source(std::move(_source))
+    {
+    }
+
+    /* Forgets everything, for the next run. */
+    void clear();
+    void record_branch(const TaintRange& r);
+    /* The offsets below `input_len` that reached a branch condition, ascending. */
+    [[nodiscard]] std::vector<uint32_t> hot_offsets(uint64_t input_len) const;
+
+    /* Pathname of the input, reads from it are labelled. */
+    const std::string source;
+    std::array<TaintRange, 32> regs {};
+
+private:
+    /* Loops comparing the same bytes over and over record them once. */
+    static constexpr size_t MAX_BRANCHES = 1 << 16;
+    std::unordered_set<uint64_t> branches;
+};
@@ -16,10 +16,32 @@ struct TestCase {
     }
 };
 
+/* A check of one component that needs no test binary of its own. */
+struct UnitTest {
+    std::string name;
+    bool (*run)();
+};
+
 class Tester {
 public:
     static void run();
 
 private:
     const static std::vector<TestCase> test_cases;
+    const static std::vector<UnitTest> unit_tests;
+
+    static bool plic_arbitration();
+    static bool plic_claim_complete();
+    static bool snapshot_round_trip();
+    static bool syscall_table();
+    static bool file_syscalls();
+    static bool page_allocator();
+    static bool heap_break();
+    static bool coverage_never_zero();
+    static bool mutator_ops();
+    static bool scheduler();
+    static bool crash_buckets();
+    static bool output_capture();
+    static bool minimizer_trim();
+    static bool virtio_dma_bounds();
 };
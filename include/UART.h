@@ -1,7 +1,6 @@
 #pragma once
 
 #include <array>
-#include <atomic>
 #include <cstdint>
 #include <iostream>
 #include <mutex>
@@ -15,9 +14,9 @@ class UART : public Device {
 public:
     UART();
     UART(const UART& other)
+        : Device(other)
     {
         uart_mem = other.uart_mem;
-        interrupting = false;
     }
 
     [[nodiscard]] std::pair<uint64_t, ReturnException> load(uint64_t, size_t) override;
@@ -27,10 +26,10 @@ public:
 
     [[nodiscard]] uint64_t get_size() const override { return UART_SIZE; }
 
-    [[nodiscard]] bool is_interrupting() override
-    {
-        return interrupting.exchange(false, std::memory_order_acquire);
-    }
+    [[nodiscard]] uint32_t get_irq() const override { return UART_IRQ; }
+
+    void save(SnapshotWriter&) const override;
+    void restore(SnapshotReader&) override;
 
 private:
     uint64_t load8(uint64_t);
@@ -38,5 +37,4 @@ private:
 
     std::array<uint8_t, UART_SIZE> uart_mem;
     std::mutex mu;
-    std::atomic<bool> interrupting;
 };
@@ -5,15 +5,20 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <Bus.h>
+#include <CmpLog.h>
+#include <Coverage.h>
 #include <FRegFile.h>
 #include <InstructionDecoder.h>
+#include <OutputSink.h>
 #include <RegFile.h>
+#include <Taint.h>
 
 class VEmu {
 public:
@@ -26,18 +31,94 @@ public:
     VEmu(FileInfo* info, const std::vector<char*>& args,
          uint64_t mem_size = 128 * 1024 * 1024);
 
+    /* Exit code of a guest that crashed, by calling exit(11) or by a fatal trap. */
+    static constexpr uint8_t CRASH_EXIT_CODE = 11;
+
     uint32_t run();
+    /* The guest's exit code, 0 while it has not exited. */
+    [[nodiscard]] uint32_t get_exit_code() const { return has_exited ? exit_code : 0; }
+    /* Runs until `stop_pc` is about to execute, false if the guest exited first. */
+    bool run_until(uint64_t stop_pc);
+    /* Stops the guest once `n` instructions have retired since the last reset. */
+    void set_instruction_limit(uint64_t n) { instruction_limit = n; }
+    [[nodiscard]] uint64_t instructions_retired() const { return retired; }
+    [[nodiscard]] bool timed_out() const
+    {
+        return !has_exited && retired >= instruction_limit;
+    }
+    /*
+     * Where the guest stopped: the pc of the instruction that exited, trapped
+     * or was about to run, and a hash of the innermost return addresses.
+     */
+    struct StopSite {
+        uint64_t pc;
+        uint64_t stack_hash;
+    };
+    [[nodiscard]] StopSite stop_site() const;
+    /* The fatal trap that ended the run, NormalExecutionReturn if there was none. */
+    [[nodiscard]] ReturnException get_fault() const { return fault; }
+    static std::string stringify_exception(ReturnException e);
+
     void dump_regs();
     std::array<int64_t, 32> get_iregs();
     std::array<double, 32> get_fregs();
 
-    VEmu(const VEmu& other)
-        : bus { other.bus }
+    /* Writes the whole machine to `path`, see Snapshot.h for the layout. */
+    bool save_snapshot(const std::string& path);
+    /* Replaces the machine with the one in `path`, guest RAM is mapped lazily. */
+    bool restore_snapshot(const std::string& path);
+
+    VEmu(const VEmu& other);
+    VEmu& operator=(const VEmu&) = delete;
+
+    /*
+     * Rolls the machine back to `golden`, which this emulator must have been
+     * copied from. Only the memory blocks written since then are restored.
+     */
+    void reset_to(const VEmu& golden);
+
+    /*
+     * Guest opens of `pathname` are served from `data` without touching the
+     * host. The registration is kept across reset_to().
+     */
+    void set_virtual_file(const std::string& pathname, std::shared_ptr<const char[]> data,
+                          uint64_t len);
+    /* Counts the taken control-flow edges into `map`, nullptr turns it off. */
+    void set_coverage(CoverageMap* map) { coverage = map; }
+    /* Logs the operands of branches, SLT* and SUB* into `log`, nullptr turns it off. */
+    void set_cmplog(CmpLog* log) { cmplog = log; }
+    /*
+     * Receives what the guest writes to stdout and stderr, nullptr discards it.
+     * The virtio console writes to `out` as well.
+     */
+    void set_output(OutputSink* out, OutputSink* err)
     {
-        bin_file_name = other.bin_file_name;
-        pc = other.pc;
-        ram_size = other.ram_size;
+        stdout_sink = out;
+        stderr_sink = err;
+        if (bus.get_console() != nullptr)
+            bus.get_console()->set_output(out);
     }
+    /*
+     * Follows the input through the run into branch conditions, nullptr turns
+     * it off. Slows every instruction down, meant for separate analysis runs.
+     */
+    void set_taint(TaintTracker* tracker);
+    /*
+     * Labels `len` bytes at `addr` as the input bytes from `offset` on, while
+     * taint is followed.
+     */
+    void label_input(uint64_t addr, uint64_t len, uint64_t offset = 0);
+
+    /* Writes guest memory regardless of its permissions, e.g. to mutate code. */
+    void patch_memory(uint64_t addr, const uint8_t* data, uint64_t len);
+    /* Carves a readable and writable buffer out of the guest heap. */
+    uint64_t allocate_buffer(uint64_t len);
+    void set_ireg(uint64_t reg, uint64_t value) { iregs.store_reg(reg, value); }
+    /*
+     * Carries out the Linux syscall a user-level guest requested in a7, with
+     * the result in a0. Fuzz builds do so on every ECALL.
+     */
+    void handle_syscall();
 
     VEmu fork()
     {
@@ -48,7 +129,9 @@ public:
 private:
     void init_func_map();
     void init_misa();
-    std::map<IName, std::function<ReturnException(VEmu*)>> inst_funcs;
+    using Handler = ReturnException (VEmu::*)();
+    /* Indexed by IName, names without a handler of their own map to XXX. */
+    std::array<Handler, static_cast<size_t>(IName::XXX) + 1> inst_funcs;
 
     ReturnException LB();
     ReturnException LH();
@@ -153,6 +236,7 @@ private:
 
     ReturnException SRET();
     ReturnException MRET();
+    ReturnException WFI();
 
     ReturnException FLW();
     ReturnException FSW();
@@ -195,6 +279,9 @@ private:
     void read_file();
     std::string bin_file_name;
 
+    void save_state(SnapshotWriter&) const;
+    bool restore_state(SnapshotReader&);
+
 private:
     constexpr static size_t CSR_NUM = 4096;
     std::array<uint64_t, CSR_NUM> csrs;
@@ -218,20 +305,33 @@ private:
     FRegFile fregs;
     uint32_t hex_instr;
     Instruction curr_instr;
+
+    /*
+     * Decoded instructions by pc. Fuzz runs from one snapshot execute the
+     * same code over and over, so each is decoded once. An entry only hits
+     * while the fetched word matches, code that changes is decoded again.
+     */
+    struct DecodedInsn {
+        uint64_t pc = ~0ULL;
+        uint32_t hex = 0;
+        Instruction insn;
+    };
+    static constexpr size_t DECODE_CACHE_SIZE = 1 << 12;
+    std::vector<DecodedInsn> decode_cache { DECODE_CACHE_SIZE };
     uint64_t pc;
     uint64_t code_size;
     uint64_t ram_size;
 
 private:
     void take_interrupt(Interrupt i);
+    void update_external_interrupts();
+    void update_timer_interrupt();
     Interrupt check_pending_interrupt();
     void trap(ReturnException e);
     bool is_fatal(ReturnException e);
     void exit_fatally(ReturnException e);
     void exit_emu(uint8_t exit_code);
-    std::string stringify_exception(ReturnException e);
 
-    static constexpr int UART_IRQ = 10;
 
 private:
     enum class FileType {
@@ -239,26 +339,136 @@ private:
         Stdout,
         Stderr,
         DiskFile,
+        Closed,
     };
+    /*
+     * File contents are immutable once opened, so snapshots and forks share
+     * them. Host files are mappings from the FileCache.
+     */
     struct FileHandle {
-        char* data;
-        const char* pathname;
+        std::shared_ptr<const char[]> data;
+        std::string pathname;
         int fd;
         uint64_t len;
         uint64_t idx;
         FileType type;
     };
+    /* Indexed by guest fd, a closed fd leaves a Closed slot for reuse. */
     std::vector<FileHandle> file_table {
-        FileHandle {nullptr,  nullptr, 0, 0, 0, FileType::Stdin },
-        FileHandle { nullptr, nullptr, 1, 0, 0, FileType::Stdout},
-        FileHandle { nullptr, nullptr, 2, 0, 0, FileType::Stderr},
+        FileHandle {nullptr,  "", 0, 0, 0, FileType::Stdin },
+        FileHandle { nullptr, "", 1, 0, 0, FileType::Stdout},
+        FileHandle { nullptr, "", 2, 0, 0, FileType::Stderr},
     };
+    int alloc_fd();
+
+    struct VirtualFile {
+        std::string pathname;
+        std::shared_ptr<const char[]> data;
+        uint64_t len;
+    };
+    std::vector<VirtualFile> virtual_files;
+
+    OutputSink* stdout_sink = nullptr;
+    OutputSink* stderr_sink = nullptr;
+
+    /*
+     * Linux syscalls of user-level guests, dispatched on a7 through a table
+     * indexed by number. Handlers get a0 to a5 and return what the guest
+     * finds in a0, errors as negated errno values. Numbers without a
+     * handler fail with -ENOSYS.
+     */
+    using SyscallArgs = std::array<uint64_t, 6>;
+    using SyscallHandler = int64_t (VEmu::*)(const SyscallArgs&);
+    static constexpr size_t SYSCALL_TABLE_SIZE = SYSCALL_NR_OPEN + 1;
+    static const std::array<SyscallHandler, SYSCALL_TABLE_SIZE>& syscall_table();
+
+    FileHandle* find_file(uint64_t fd)
+    {
+        if (fd >= file_table.size() || file_table[fd].type == FileType::Closed)
+            return nullptr;
+        return &file_table[fd];
+    }
+    /* Gives the handle the lowest free fd and returns it. */
+    int install_file(FileHandle fh);
+    int64_t copy_to_guest(uint64_t addr, const void* src, uint64_t len);
+    int64_t open_file(const std::string& pathname, uint64_t flags);
+    int64_t read_file(FileHandle& fh, uint64_t buf, uint64_t count);
+    int64_t write_file(FileHandle& fh, uint64_t buf, uint64_t count);
+    int64_t transfer_vector(const SyscallArgs& args, bool write);
+
+    int64_t sys_ioctl(const SyscallArgs& args);
+    int64_t sys_openat(const SyscallArgs& args);
+    int64_t sys_open(const SyscallArgs& args);
+    int64_t sys_close(const SyscallArgs& args);
+    int64_t sys_lseek(const SyscallArgs& args);
+    int64_t sys_read(const SyscallArgs& args);
+    int64_t sys_write(const SyscallArgs& args);
+    int64_t sys_readv(const SyscallArgs& args);
+    int64_t sys_writev(const SyscallArgs& args);
+    int64_t sys_fstat(const SyscallArgs& args);
+    int64_t sys_exit(const SyscallArgs& args);
+    int64_t sys_clock_gettime(const SyscallArgs& args);
+    int64_t sys_gettimeofday(const SyscallArgs& args);
+    int64_t sys_uname(const SyscallArgs& args);
+    int64_t sys_getpid(const SyscallArgs& args);
+    int64_t sys_brk(const SyscallArgs& args);
+    int64_t sys_mmap(const SyscallArgs& args);
+    int64_t sys_munmap(const SyscallArgs& args);
+
+    static constexpr size_t ARG_SIZE = 256;
 
     bool has_exited = false;
     uint8_t exit_code = 0;
+    uint64_t exit_pc = 0;
+    ReturnException fault = ReturnException::NormalExecutionReturn;
+
+    uint64_t retired = 0;
+    uint64_t instruction_limit = ~0ULL;
+
+    /* `pc` is 4 bytes short of the destination when a handler returns. */
+    void record_edge(uint64_t from)
+    {
+        if (coverage != nullptr)
+            coverage->hit_edge(from, pc + 4);
+    }
+    CoverageMap* coverage = nullptr;
+
+    void record_cmp(int64_t op1, int64_t op2)
+    {
+        if (cmplog != nullptr)
+            cmplog->record(pc, static_cast<uint64_t>(op1), static_cast<uint64_t>(op2));
+    }
+    CmpLog* cmplog = nullptr;
+
+    /* Moves taint from the sources of the instruction in hex_instr to its result. */
+    void propagate_taint();
+    TaintTracker* taint = nullptr;
+
+    /*
+     * Shadow stack of return addresses, pushed by calls that link through ra
+     * or t0 and popped by returns through them. Deep recursion wraps around,
+     * only the innermost frames are ever looked at.
+     */
+    static constexpr uint32_t CALL_STACK_SIZE = 64;
+    static constexpr uint32_t STACK_HASH_FRAMES = 8;
+    static bool is_link_reg(uint64_t reg) { return reg == REG_RA || reg == REG_T0; }
+    void record_call(uint64_t rd, uint64_t ret_addr)
+    {
+        if (is_link_reg(rd))
+            call_stack[call_depth++ % CALL_STACK_SIZE] = ret_addr;
+    }
+    void record_return(uint64_t rd, uint64_t rs1)
+    {
+        if (rd == REG_ZERO && is_link_reg(rs1) && call_depth > 0)
+            call_depth--;
+    }
+    std::array<uint64_t, CALL_STACK_SIZE> call_stack {};
+    uint32_t call_depth = 0;
 
 #ifdef TEST_ENV
 public:
     bool test_flag_done = false;
+    /* The unit tests look at the machine state directly. */
+    friend class Tester;
 #endif
 };
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+#include <Device.h>
+#include <MMU.h>
+#include <OutputSink.h>
+#include <defs.h>
+
+/*
+ * A virtio-console device over the virtio-mmio (version 2) transport. Unlike
+ * the UART, which moves a byte per MMIO access, the guest hands whole buffers
+ * to the device through the virtqueues and notifies it once per batch.
+ */
+class VirtioConsole : public Device {
+public:
+    explicit VirtioConsole(MMU* mmu);
+    VirtioConsole(const VirtioConsole& other, MMU* mmu);
+
+    [[nodiscard]] std::pair<uint64_t, ReturnException> load(uint64_t, size_t) override;
+    ReturnException store(uint64_t, uint64_t, size_t) override;
+
+    [[nodiscard]] uint64_t get_base() const override { return VIRTIO_BASE; }
+
+    [[nodiscard]] uint64_t get_size() const override { return VIRTIO_SIZE; }
+
+    [[nodiscard]] uint32_t get_irq() const override { return VIRTIO_IRQ; }
+
+    void save(SnapshotWriter&) const override;
+    void restore(SnapshotReader&) override;
+
+    /* Queues host bytes for the guest, they are delivered through receiveq. */
+    void push_input(const char* data, size_t len);
+    /* Receives the guest's output instead of stdout, nullptr discards it. */
+    void set_output(OutputSink* out) { sink = out; }
+
+private:
+    static constexpr uint32_t QUEUE_NUM_MAX = 256;
+    static constexpr uint32_t RECEIVEQ = 0;
+    static constexpr uint32_t TRANSMITQ = 1;
+    static constexpr uint32_t QUEUES_NUM = 2;
+
+    struct VirtQueue {
+        uint32_t num = 0;
+        uint32_t ready = 0;
+        uint64_t desc = 0;
+        uint64_t driver = 0;
+        uint64_t device = 0;
+        uint16_t last_avail_idx = 0;
+    };
+
+    struct VirtqDesc {
+        uint64_t addr;
+        uint32_t len;
+        uint16_t flags;
+        uint16_t next;
+    };
+
+    [[nodiscard]] uint32_t load32(uint64_t) const;
+    void store32(uint64_t, uint32_t);
+    void store_queue_reg(VirtQueue&, uint64_t, uint32_t);
+    [[nodiscard]] uint64_t load_config(uint64_t, size_t) const;
+
+    void notify(uint32_t queue_idx);
+    [[nodiscard]] bool process_transmitq();
+    [[nodiscard]] bool process_receiveq();
+    void reset();
+    void needs_reset();
+    void write_output(const uint8_t* data, uint64_t len);
+    [[nodiscard]] bool broken() const
+    {
+        return (status & VIRTIO_STATUS_DEVICE_NEEDS_RESET) != 0;
+    }
+
+    /* These fail if the guest points the device outside of RAM. */
+    [[nodiscard]] bool load_avail_idx(const VirtQueue&, uint16_t&) const;
+    [[nodiscard]] bool load_avail_ring(const VirtQueue&, uint16_t, uint16_t&) const;
+    [[nodiscard]] bool load_desc(const VirtQueue&, uint16_t, VirtqDesc&) const;
+    [[nodiscard]] bool push_used(VirtQueue&, uint32_t id, uint32_t len);
+
+    MMU* mmu;
+    std::array<VirtQueue, QUEUES_NUM> queues;
+    uint32_t queue_sel = 0;
+    uint32_t device_features_sel = 0;
+    uint32_t driver_features_sel = 0;
+    uint64_t driver_features = 0;
+    uint32_t status = 0;
+    uint32_t interrupt_status = 0;
+
+    /* Stdout unless set_output() picked another sink. */
+    OutputSink host_out = OutputSink::host_fd(STDOUT_FILENO);
+    OutputSink* sink = &host_out;
+    std::string tx_buffer;
+    std::string rx_pending;
+    std::mutex mu;
+};
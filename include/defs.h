@@ -43,14 +43,27 @@
 #define CLINT_SIZE (uint64_t)0x10000
 #define CLINT_MTIMECMP (uint64_t) CLINT_BASE + 0x4000
 #define CLINT_MTIME (uint64_t) CLINT_BASE + 0xbff8
+#define CLINT_TIMEBASE_FREQ 10'000'000
 
 #define PLIC_BASE (uint64_t)0xc00'0000
 #define PLIC_SIZE (uint64_t)0x400'0000
+#define PLIC_PRIORITY (uint64_t) PLIC_BASE + 0x0
 #define PLIC_PENDING (uint64_t) PLIC_BASE + 0x1000
+#define PLIC_ENABLE (uint64_t) PLIC_BASE + 0x2000
+#define PLIC_ENABLE_STRIDE (uint64_t)0x80
+#define PLIC_CONTEXT (uint64_t) PLIC_BASE + 0x200000
+#define PLIC_CONTEXT_STRIDE (uint64_t)0x1000
 #define PLIC_SENABLE (uint64_t) PLIC_BASE + 0x2080
-#define PLIC_SPRIORITY (uint64_t) PLIC_BASE + 0x201000
+#define PLIC_STHRESHOLD (uint64_t) PLIC_BASE + 0x201000
 #define PLIC_SCLAIM (uint64_t) PLIC_BASE + 0x201004
 
+/* Context 0 is hart 0 in machine mode and context 1 is hart 0 in supervisor mode. */
+#define PLIC_CONTEXT_M 0
+#define PLIC_CONTEXT_S 1
+
+#define VIRTIO_IRQ 1
+#define UART_IRQ 10
+
 #define UART_BASE (uint64_t)0x1000'0000
 #define UART_SIZE (uint64_t)0x100
 #define UART_RHR (uint64_t) UART_BASE + 0
@@ -70,6 +83,48 @@
  */
 #define UART_LSR_TX (uint8_t)(1 << 5)
 
+#define VIRTIO_BASE (uint64_t)0x1000'1000
+#define VIRTIO_SIZE (uint64_t)0x1000
+#define VIRTIO_MAGIC (uint64_t) VIRTIO_BASE + 0x000
+#define VIRTIO_VERSION (uint64_t) VIRTIO_BASE + 0x004
+#define VIRTIO_DEVICE_ID (uint64_t) VIRTIO_BASE + 0x008
+#define VIRTIO_VENDOR_ID (uint64_t) VIRTIO_BASE + 0x00c
+#define VIRTIO_DEVICE_FEATURES (uint64_t) VIRTIO_BASE + 0x010
+#define VIRTIO_DEVICE_FEATURES_SEL (uint64_t) VIRTIO_BASE + 0x014
+#define VIRTIO_DRIVER_FEATURES (uint64_t) VIRTIO_BASE + 0x020
+#define VIRTIO_DRIVER_FEATURES_SEL (uint64_t) VIRTIO_BASE + 0x024
+#define VIRTIO_QUEUE_SEL (uint64_t) VIRTIO_BASE + 0x030
+#define VIRTIO_QUEUE_NUM_MAX (uint64_t) VIRTIO_BASE + 0x034
+#define VIRTIO_QUEUE_NUM (uint64_t) VIRTIO_BASE + 0x038
+#define VIRTIO_QUEUE_READY (uint64_t) VIRTIO_BASE + 0x044
+#define VIRTIO_QUEUE_NOTIFY (uint64_t) VIRTIO_BASE + 0x050
+#define VIRTIO_INTERRUPT_STATUS (uint64_t) VIRTIO_BASE + 0x060
+#define VIRTIO_INTERRUPT_ACK (uint64_t) VIRTIO_BASE + 0x064
+#define VIRTIO_STATUS (uint64_t) VIRTIO_BASE + 0x070
+#define VIRTIO_QUEUE_DESC_LOW (uint64_t) VIRTIO_BASE + 0x080
+#define VIRTIO_QUEUE_DESC_HIGH (uint64_t) VIRTIO_BASE + 0x084
+#define VIRTIO_QUEUE_DRIVER_LOW (uint64_t) VIRTIO_BASE + 0x090
+#define VIRTIO_QUEUE_DRIVER_HIGH (uint64_t) VIRTIO_BASE + 0x094
+#define VIRTIO_QUEUE_DEVICE_LOW (uint64_t) VIRTIO_BASE + 0x0a0
+#define VIRTIO_QUEUE_DEVICE_HIGH (uint64_t) VIRTIO_BASE + 0x0a4
+#define VIRTIO_CONFIG_GENERATION (uint64_t) VIRTIO_BASE + 0x0fc
+#define VIRTIO_CONFIG (uint64_t) VIRTIO_BASE + 0x100
+
+#define VIRTIO_MAGIC_VALUE (uint32_t)0x74726976
+#define VIRTIO_VENDOR_VALUE (uint32_t)0x554d4551
+#define VIRTIO_CONSOLE_DEVICE_ID (uint32_t)3
+
+/* Virtqueue descriptor flags. */
+#define VIRTQ_DESC_F_NEXT (uint16_t)1
+#define VIRTQ_DESC_F_WRITE (uint16_t)2
+
+/* Interrupt status bits: the used ring was updated, the device state changed. */
+#define VIRTIO_INT_USED_RING (uint32_t)1
+#define VIRTIO_INT_CONFIG (uint32_t)2
+
+/* Device status bit: the device hit an error it cannot recover from alone. */
+#define VIRTIO_STATUS_DEVICE_NEEDS_RESET (uint32_t)64
+
 #define AM_OPCODE (uint8_t)0b0101111
 
 #define FP_R_OPCODE (uint8_t)0b1010011
@@ -175,6 +230,7 @@ enum class IName : uint8_t {
 
     SRET,
     MRET,
+    WFI,
 
     FLW,
     FSW,
@@ -243,6 +299,7 @@ enum class IName : uint8_t {
 
 #define MSTATUS_MIE_POS 3U
 #define MSTATUS_MPIE_POS 7U
+#define MSTATUS_TW_POS 21U
 
 #define MIP_SSIP_POS 1U
 #define MIP_MSIP_POS 3U
@@ -284,15 +341,35 @@ enum class IName : uint8_t {
 #define REG_T5 30
 #define REG_T6 31
 
+#define SYSCALL_NR_IOCTL 29
+#define SYSCALL_NR_OPENAT 56
 #define SYSCALL_NR_CLOSE 57
 #define SYSCALL_NR_WRITE 64
 #define SYSCALL_NR_LSEEK 62
 #define SYSCALL_NR_READ 63
+#define SYSCALL_NR_READV 65
+#define SYSCALL_NR_WRITEV 66
 #define SYSCALL_NR_FSTAT 80
 #define SYSCALL_NR_EXIT 93
+#define SYSCALL_NR_EXIT_GROUP 94
+#define SYSCALL_NR_SET_TID_ADDRESS 96
+#define SYSCALL_NR_CLOCK_GETTIME 113
+#define SYSCALL_NR_UNAME 160
+#define SYSCALL_NR_GETTIMEOFDAY 169
+#define SYSCALL_NR_GETPID 172
 #define SYSCALL_NR_BRK 214
+#define SYSCALL_NR_MUNMAP 215
+#define SYSCALL_NR_MMAP 222
 #define SYSCALL_NR_OPEN 1024
 
+/* open flags as the guest's newlib encodes them, they differ from the host's. */
+#define GUEST_O_ACCMODE 0x3
+#define GUEST_O_RDONLY 0x0
+#define GUEST_O_WRONLY 0x1
+#define GUEST_O_CREAT 0x200
+#define GUEST_O_TRUNC 0x400
+#define GUEST_O_EXCL 0x800
+
 enum class Mode : uint8_t { User = 0b00, Supervisor = 0b01, Machine = 0b11 };
 
 enum class ReturnException : uint8_t {
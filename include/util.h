@@ -7,11 +7,9 @@
 #pragma GCC diagnostic pop
 using namespace ELFIO;
 
-#include <map>
-#include <mutex>
+#include <unordered_map>
 
 typedef uint8_t BytePermission;
-using MutationHistory = std::map<std::pair<uint64_t, uint64_t>, uint8_t>;
 
 struct MemorySegment {
     BytePermission perms;
@@ -31,21 +29,15 @@ struct FileInfo {
     std::string file_name;
     std::vector<MemorySegment> segments;
     uint64_t entry_point;
-    std::mutex lock;
+    /* Address of the `main` symbol, all ones for stripped binaries. */
+    uint64_t main_addr = ~0ULL;
+    /* Function symbols by name, empty for stripped binaries. */
+    std::unordered_map<std::string, uint64_t> functions;
 };
 
 std::vector<char*> substitute_input(const char** args, size_t len, const char* input_name);
 FileInfo* read_elf(const std::string& fname, bool exit_fatally = true);
+/* Resolves a function name or a 0x-prefixed address, all ones if unknown. */
+uint64_t resolve_address(const FileInfo* info, const std::string& spec);
+void seed_rand(uint64_t s);
 uint64_t gen_rand();
-
-class Corpus {
-public:
-    explicit Corpus(const std::string& dir_path);
-    FileInfo* get_random_free_file();
-
-private:
-    std::vector<FileInfo*> corpus_files;
-};
-
-void push_mutate(FileInfo* info, uint64_t n_bytes, MutationHistory& history);
-void pop_mutate(FileInfo* info, const MutationHistory& history);
@@ -27,6 +27,52 @@ ReturnException Bus::store(uint64_t addr, uint64_t data, size_t sz)
         }
     }
 #endif
-    get_mmu()->store(addr, data, sz);
-    return ReturnException::NormalExecutionReturn;
+    return get_mmu()->store(addr, data, sz);
+}
+
+void Bus::save(SnapshotWriter& w) const
+{
+    w.put<uint64_t>(devices.size());
+    for (const Device* device : devices)
+        device->save(w);
+    mmu->save(w);
+}
+
+/* Fails on a snapshot taken with a different set of devices. */
+bool Bus::restore(SnapshotReader& r)
+{
+    if (r.get<uint64_t>() != devices.size())
+        r.fail();
+    for (Device* device : devices) {
+        if (!r.ok())
+            return false;
+        device->restore(r);
+    }
+    mmu->restore(r);
+    return r.ok();
+}
+
+/*
+ * Device state is small, it is copied over wholesale. Memory only rolls back
+ * the blocks written since the last reset.
+ */
+void Bus::reset_to(const Bus& other)
+{
+    for (size_t i = 0; i < devices.size(); i++) {
+        SnapshotWriter w;
+        other.devices[i]->save(w);
+        SnapshotReader r(w.data().data(), w.data().size());
+        devices[i]->restore(r);
+    }
+    mmu->reset_to(*other.mmu);
+}
+
+/* Forwards the interrupt requests of the devices to their PLIC sources. */
+void Bus::poll_interrupts()
+{
+    uint64_t pending = irqs.take();
+    while (pending != 0) {
+        plic->raise(static_cast<uint32_t>(__builtin_ctzll(pending)));
+        pending &= pending - 1;
+    }
 }
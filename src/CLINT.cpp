@@ -2,8 +2,49 @@
 
 CLINT::CLINT()
 {
-    mtime = 0;
-    mtimecmp = 0;
+    epoch = std::chrono::steady_clock::now();
+    /* No timer interrupt until the guest asks for one. */
+    mtimecmp = NEVER;
+}
+
+void CLINT::save(SnapshotWriter& w) const
+{
+    w.put(load_mtime());
+    w.put(mtimecmp);
+}
+
+/* The restored clock resumes from the saved mtime, not from the host time. */
+void CLINT::restore(SnapshotReader& r)
+{
+    store_mtime(r.get<uint64_t>());
+    mtimecmp = r.get<uint64_t>();
+}
+
+uint64_t CLINT::load_mtime() const
+{
+    auto elapsed = std::chrono::steady_clock::now() - epoch;
+    return static_cast<uint64_t>(std::chrono::duration_cast<Ticks>(elapsed).count());
+}
+
+void CLINT::store_mtime(uint64_t value)
+{
+    epoch = std::chrono::steady_clock::now() - Ticks(static_cast<int64_t>(value));
+}
+
+std::chrono::steady_clock::time_point CLINT::timer_deadline() const
+{
+    /* Far-off compare values would overflow the host clock, they count as never. */
+    static constexpr uint64_t MAX_WAIT = 24ULL * 3600 * CLINT_TIMEBASE_FREQ;
+
+    auto now = std::chrono::steady_clock::now();
+    uint64_t mtime = load_mtime();
+    if (mtimecmp <= mtime)
+        return now;
+    if (mtimecmp - mtime > MAX_WAIT)
+        return std::chrono::steady_clock::time_point::max();
+
+    auto wait = Ticks(static_cast<int64_t>(mtimecmp - mtime));
+    return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait);
 }
 
 uint64_t CLINT::load64(uint64_t addr) const
@@ -12,7 +53,7 @@ uint64_t CLINT::load64(uint64_t addr) const
     case CLINT_MTIMECMP:
         return mtimecmp;
     case CLINT_MTIME:
-        return mtime;
+        return load_mtime();
     default:
         break;
     }
@@ -27,7 +68,7 @@ void CLINT::store64(uint64_t addr, uint64_t data)
         mtimecmp = data;
         break;
     case CLINT_MTIME:
-        mtime = data;
+        store_mtime(data);
         break;
     default:
         break;
@@ -0,0 +1,113 @@
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Corpus.h>
+#include <util.h>
+
+/* Stands in for files that are empty or could not be mapped. */
+static const char empty_input[1] = { 0 };
+
+Corpus::Corpus(const std::string& dir_path)
+    : dir(dir_path)
+    , entries(new Entry[MAX_ENTRIES])
+{
+    paths.reserve(MAX_ENTRIES);
+
+    std::error_code ec;
+    for (const auto& file : std::filesystem::directory_iterator(dir_path, ec)) {
+        if (paths.size() == MAX_ENTRIES)
+            break;
+        if (file.is_regular_file())
+            append(file.path().string(), nullptr, 0, 0, 0);
+    }
+
+    if (ec || size() == 0) {
+        std::cout << "No inputs found in the corpus directory " << dir_path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+size_t Corpus::random_index() const { return gen_rand() % size(); }
+
+std::string_view Corpus::get(size_t idx) const
+{
+    const Entry& e = entries[idx];
+    const char* data = e.data.load(std::memory_order_acquire);
+    if (data == nullptr)
+        data = map(idx);
+    return { data, e.size.load(std::memory_order_relaxed) };
+}
+
+/*
+ * Workers may race to map the same entry. The size is stored before the data
+ * pointer is published and both agree on it, the loser unmaps its copy.
+ */
+const char* Corpus::map(size_t idx) const
+{
+    Entry& e = entries[idx];
+    const char* data = empty_input;
+    uint64_t len = 0;
+
+    int fd = open(paths[idx].c_str(), O_RDONLY);
+    struct stat st {};
+    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+                       fd, 0);
+        if (p != MAP_FAILED) {
+            data = static_cast<const char*>(p);
+            len = static_cast<uint64_t>(st.st_size);
+        }
+    }
+    if (fd != -1)
+        close(fd);
+
+    e.size.store(len, std::memory_order_relaxed);
+    const char* expected = nullptr;
+    if (!e.data.compare_exchange_strong(expected, data, std::memory_order_acq_rel)) {
+        if (data != empty_input)
+            munmap(const_cast<char*>(data), len);
+        return expected;
+    }
+    return data;
+}
+
+void Corpus::append(std::string path, const char* data, uint64_t len, uint64_t exec_insns,
+                    uint32_t new_edges)
+{
+    size_t idx = paths.size();
+    Entry& e = entries[idx];
+    e.data.store(data, std::memory_order_relaxed);
+    e.size.store(len, std::memory_order_relaxed);
+    e.exec_insns.store(exec_insns, std::memory_order_relaxed);
+    e.new_edges.store(new_edges, std::memory_order_relaxed);
+    paths.push_back(std::move(path));
+    n_entries.store(paths.size(), std::memory_order_release);
+}
+
+/* The bytes are kept in memory as well, nobody has to map the new file again. */
+void Corpus::promote(std::string_view data, uint64_t exec_insns, uint32_t new_edges)
+{
+    std::lock_guard<std::mutex> lock(append_lock);
+    if (paths.size() == MAX_ENTRIES)
+        return;
+
+    std::filesystem::path path;
+    do {
+        path = std::filesystem::path(dir) / ("cov-" + std::to_string(next_id++));
+    } while (std::filesystem::exists(path));
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file)
+        return;
+
+    char* copy = new char[std::max<size_t>(data.size(), 1)];
+    memcpy(copy, data.data(), data.size());
+    append(path.string(), copy, data.size(), exec_insns, new_edges);
+}
@@ -0,0 +1,103 @@
+#include <cstring>
+
+#include <Coverage.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static constexpr std::array<uint8_t, 256> make_bucket_lookup()
+{
+    std::array<uint8_t, 256> lookup {};
+    for (size_t i = 0; i < lookup.size(); i++) {
+        if (i <= 2)
+            lookup[i] = static_cast<uint8_t>(i);
+        else if (i == 3)
+            lookup[i] = 4;
+        else if (i <= 7)
+            lookup[i] = 8;
+        else if (i <= 15)
+            lookup[i] = 16;
+        else if (i <= 31)
+            lookup[i] = 32;
+        else if (i <= 127)
+            lookup[i] = 64;
+        else
+            lookup[i] = 128;
+    }
+    return lookup;
+}
+
+static constexpr std::array<uint8_t, 256> bucket_lookup = make_bucket_lookup();
+
+/* Most of the map is zero, so whole words are skipped before looking at bytes. */
+void CoverageMap::classify()
+{
+    auto* words = reinterpret_cast<uint64_t*>(map.data());
+    for (size_t w = 0; w < COVERAGE_MAP_SIZE / 8; w++) {
+        if (words[w] == 0)
+            continue;
+        uint8_t* bytes = map.data() + w * 8;
+        for (size_t i = 0; i < 8; i++)
+            bytes[i] = bucket_lookup[bytes[i]];
+    }
+}
+
+uint64_t CoverageMap::hash() const
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    const auto* words = reinterpret_cast<const uint64_t*>(map.data());
+    for (uint64_t w = 0; w < COVERAGE_MAP_SIZE / 8; w++) {
+        if (words[w] == 0)
+            continue;
+        h = (h ^ (words[w] + w)) * 0x100000001B3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+uint32_t VirginMap::merge(const CoverageMap& trace)
+{
+    uint32_t new_bytes = 0;
+    const uint8_t* t = trace.data();
+    uint8_t* v = map.data();
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < COVERAGE_MAP_SIZE; i += 16) {
+        __m128i tv = _mm_load_si128(reinterpret_cast<const __m128i*>(t + i));
+        __m128i vv = _mm_load_si128(reinterpret_cast<const __m128i*>(v + i));
+        __m128i hit = _mm_and_si128(tv, vv);
+        auto unchanged
+            = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hit, zero)));
+        if (unchanged == 0xFFFF)
+            continue;
+        _mm_store_si128(reinterpret_cast<__m128i*>(v + i), _mm_andnot_si128(tv, vv));
+        new_bytes += static_cast<uint32_t>(__builtin_popcount(~unchanged & 0xFFFF));
+    }
+#else
+    for (size_t i = 0; i < COVERAGE_MAP_SIZE; i += 8) {
+        uint64_t tw;
+        uint64_t vw;
+        memcpy(&tw, t + i, 8);
+        memcpy(&vw, v + i, 8);
+        uint64_t hit = tw & vw;
+        if (hit == 0)
+            continue;
+        vw &= ~tw;
+        memcpy(v + i, &vw, 8);
+        for (; hit != 0; hit >>= 8)
+            new_bytes += (hit & 0xFF) != 0;
+    }
+#endif
+
+    return new_bytes;
+}
+
+uint64_t VirginMap::edges_found() const
+{
+    uint64_t edges = 0;
+    for (uint8_t byte : map)
+        edges += byte != 0xFF;
+    return edges;
+}
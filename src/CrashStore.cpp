@@ -0,0 +1,85 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <CrashStore.h>
+
+CrashStore::CrashStore(std::string _dir)
+    : dir(std::move(_dir))
+{
+}
+
+uint64_t CrashStore::bucket(const Report& r)
+{
+    uint64_t hash = r.site.stack_hash;
+    if (r.kind == Kind::Crash)
+        hash = (hash ^ r.site.pc) * 0x100000001B3ULL;
+    hash = (hash ^ static_cast<uint64_t>(r.kind)) * 0x100000001B3ULL;
+    return hash;
+}
+
+bool CrashStore::add(const Report& r, std::string_view input, VEmu& golden)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (r.kind == Kind::Timeout && unique_timeouts() >= MAX_TIMEOUTS)
+        return false;
+    if (!buckets.insert(bucket(r)).second)
+        return false;
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (!snapshot_saved) {
+        auto path = std::filesystem::path(dir) / SNAPSHOT_NAME;
+        snapshot_saved = golden.save_snapshot(path.string());
+        if (!snapshot_saved)
+            std::cout << "Could not save a snapshot to " << path << std::endl;
+    }
+    if (!write_bundle(r, input))
+        std::cout << "Could not save a crash to " << dir << std::endl;
+
+    if (r.kind == Kind::Crash)
+        n_crashes.fetch_add(1, std::memory_order_relaxed);
+    else
+        n_timeouts.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/* The directory name already tells buckets apart, like bucket() does. */
+bool CrashStore::write_bundle(const Report& r, std::string_view input)
+{
+    bool crash = r.kind == Kind::Crash;
+    std::ostringstream name;
+    name << std::hex;
+    if (crash)
+        name << "crash-" << r.site.pc << '-' << r.site.stack_hash;
+    else
+        name << "timeout-" << r.site.stack_hash;
+    auto bundle = std::filesystem::path(dir) / name.str();
+    std::error_code ec;
+    std::filesystem::create_directories(bundle, ec);
+
+    std::ofstream in(bundle / "input", std::ios::binary);
+    in.write(input.data(), static_cast<std::streamsize>(input.size()));
+
+    if (!r.output.empty()) {
+        std::ofstream out(bundle / "output", std::ios::binary);
+        out.write(r.output.data(), static_cast<std::streamsize>(r.output.size()));
+    }
+
+    std::ofstream info(bundle / "info");
+    info << "kind         : " << (crash ? "crash" : "timeout") << '\n';
+    info << "fault        : "
+         << (r.fault == ReturnException::NormalExecutionReturn
+                 ? (crash ? "exit(11)" : "none")
+                 : VEmu::stringify_exception(r.fault))
+         << '\n';
+    info << std::hex;
+    info << "pc           : 0x" << r.site.pc << '\n';
+    info << "stack_hash   : 0x" << r.site.stack_hash << '\n';
+    info << std::dec;
+    info << "instructions : " << r.instructions << '\n';
+    info << "input_size   : " << input.size() << '\n';
+    info << "snapshot     : ../" << SNAPSHOT_NAME << '\n';
+    return static_cast<bool>(in) && static_cast<bool>(info);
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <unordered_set>
+
+#include <Dictionary.h>
+#include <MMU.h>
+
+static constexpr size_t MIN_STRING_LEN = 4;
+static constexpr size_t MAX_STRING_LEN = 32;
+/* Tokens are picked uniformly, too many of them dilute the useful ones. */
+static constexpr size_t MAX_STRINGS = 512;
+static constexpr size_t MAX_CONSTANTS = 512;
+
+/* Keeps the first `limit` distinct tokens, in the order they were found. */
+class TokenSet {
+public:
+    explicit TokenSet(size_t _limit)
+        : limit(_limit)
+    {
+    }
+
+    void add(std::string token)
+    {
+        if (tokens.size() < limit && seen.insert(token).second)
+            tokens.push_back(std::move(token));
+    }
+
+    std::vector<std::string> tokens;
+
+private:
+    size_t limit;
+    std::unordered_set<std::string> seen;
+};
+
+static bool is_printable(uint8_t c) { return (c >= 0x20 && c < 0x7F) || c == '\t'; }
+
+static void scan_strings(const MemorySegment& seg, TokenSet& out)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < seg.file_size; i++) {
+        if (is_printable(seg.data[i]))
+            continue;
+        size_t n = i - start;
+        if (seg.data[i] == 0 && n >= MIN_STRING_LEN && n <= MAX_STRING_LEN)
+            out.add(std::string(reinterpret_cast<const char*>(seg.data + start), n));
+        start = i + 1;
+    }
+}
+
+/*
+ * Values that fit a byte are left to the byte mutations. Sign-extended
+ * 32-bit values are given as 4 bytes, which is how the guest stores them.
+ */
+static void add_constant(uint64_t value, TokenSet& out)
+{
+    if (value < 0x100 || ~value < 0x100)
+        return;
+
+    size_t width = 8;
+    if (value <= 0xFFFF)
+        width = 2;
+    else if (static_cast<int64_t>(value) == static_cast<int32_t>(value))
+        width = 4;
+
+    std::string token(width, '\0');
+    for (size_t i = 0; i < width; i++)
+        token[i] = static_cast<char>(value >> (8 * i));
+    out.add(token);
+    std::reverse(token.begin(), token.end());
+    out.add(token);
+}
+
+static uint64_t sext(uint64_t value, uint32_t bits)
+{
+    uint32_t shift = 64 - bits;
+    return static_cast<uint64_t>(static_cast<int64_t>(value << shift) >> shift);
+}
+
+/*
+ * A linear sweep that follows the registers loaded with constants by the
+ * usual li sequences (lui, addi, addiw and slli), then reports the known
+ * operands of branches and subtractions and the immediates of SLTI, SLTIU
+ * and XORI. Calls and jumps forget everything.
+ */
+static void scan_compares(const MemorySegment& seg, TokenSet& out)
+{
+    std::array<bool, 32> known {};
+    std::array<uint64_t, 32> values {};
+    auto constant = [&](uint32_t reg) { return reg == 0 || known[reg]; };
+    auto value = [&](uint32_t reg) { return reg == 0 ? 0 : values[reg]; };
+
+    for (size_t off = 0; off + 4 <= seg.file_size; off += 4) {
+        uint32_t insn;
+        memcpy(&insn, seg.data + off, sizeof(insn));
+        uint32_t opcode = insn & OPCODE_MASK;
+        uint32_t rd = (insn >> 7) & 0x1F;
+        uint32_t funct3 = (insn >> 12) & 0x7;
+        uint32_t rs1 = (insn >> 15) & 0x1F;
+        uint32_t rs2 = (insn >> 20) & 0x1F;
+        uint32_t funct7 = insn >> 25;
+        uint64_t imm_i = sext(insn >> 20, 12);
+
+        bool writes_rd = true;
+        bool result_known = false;
+        uint64_t result = 0;
+        switch (opcode) {
+        case 0x37: /* LUI */
+            result_known = true;
+            result = sext(insn & 0xFFFFF000, 32);
+            break;
+        case 0x13: /* OP-IMM */
+            if (funct3 == 0 && constant(rs1)) {
+                result_known = true;
+                result = value(rs1) + imm_i;
+            } else if (funct3 == 1 && constant(rs1)) {
+                result_known = true;
+                result = value(rs1) << (imm_i & 0x3F);
+            } else if (funct3 == 2 || funct3 == 3 || funct3 == 4) {
+                add_constant(imm_i, out);
+            }
+            break;
+        case 0x1B: /* OP-IMM-32 */
+            if (funct3 == 0 && constant(rs1)) {
+                result_known = true;
+                result = sext(value(rs1) + imm_i, 32);
+            }
+            break;
+        case 0x33: /* OP */
+        case 0x3B: /* OP-32 */
+            if (funct3 == 0 && funct7 == 0x20) {
+                if (rs1 != 0 && constant(rs1))
+                    add_constant(value(rs1), out);
+                if (rs2 != 0 && constant(rs2))
+                    add_constant(value(rs2), out);
+            }
+            break;
+        case 0x63: /* BRANCH */
+            writes_rd = false;
+            if (rs1 != 0 && constant(rs1))
+                add_constant(value(rs1), out);
+            if (rs2 != 0 && constant(rs2))
+                add_constant(value(rs2), out);
+            break;
+        case 0x6F: /* JAL */
+        case 0x67: /* JALR */
+            known.fill(false);
+            break;
+        case 0x23: /* STORE */
+        case 0x27: /* STORE-FP */
+        case 0x0F: /* MISC-MEM */
+            writes_rd = false;
+            break;
+        default:
+            break;
+        }
+
+        if (writes_rd && rd != 0) {
+            known[rd] = result_known;
+            values[rd] = result;
+        }
+    }
+}
+
+std::vector<std::string> extract_dictionary(const FileInfo* info)
+{
+    TokenSet strings(MAX_STRINGS);
+    TokenSet constants(MAX_CONSTANTS);
+    for (const auto& seg : info->segments) {
+        scan_strings(seg, strings);
+        if ((seg.perms & PERM_EXEC) != 0)
+            scan_compares(seg, constants);
+    }
+
+    std::vector<std::string> tokens = std::move(constants.tokens);
+    tokens.insert(tokens.end(), strings.tokens.begin(), strings.tokens.end());
+    return tokens;
+}
@@ -6,7 +6,9 @@ void FRegFile::store_reg(size_t idx, double value) { data[idx] = value; }
 
 double FRegFile::load_reg(size_t idx) { return data[idx]; }
 
-std::array<double, 32> FRegFile::get_regs() { return data; }
+std::array<double, 32> FRegFile::get_regs() const { return data; }
+
+void FRegFile::set_regs(const std::array<double, REGS_NUM>& regs) { data = regs; }
 
 void FRegFile::dump_regs()
 {
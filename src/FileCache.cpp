@@ -0,0 +1,80 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <FileCache.h>
+
+FileCache::MappedFile::~MappedFile()
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), len);
+}
+
+FileCache& FileCache::the()
+{
+    static FileCache inst;
+    return inst;
+}
+
+static bool same_file(const FileCache::MappedFile& f, const struct stat& st)
+{
+    return f.dev == st.st_dev && f.ino == st.st_ino
+           && f.len == static_cast<uint64_t>(st.st_size)
+           && f.mtime.tv_sec == st.st_mtim.tv_sec
+           && f.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+std::shared_ptr<const FileCache::MappedFile> FileCache::open(const std::string& pathname)
+{
+    {
+        struct stat st;
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = files.find(pathname);
+        if (it != files.end() && ::stat(pathname.c_str(), &st) == 0
+            && same_file(*it->second, st))
+            return it->second;
+    }
+
+    /* Guests never get write access, the file may be mapped by other workers. */
+    int fd = ::open(pathname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return nullptr;
+    auto file = map(fd);
+    int saved_errno = errno;
+    close(fd);
+    if (file == nullptr) {
+        errno = saved_errno;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    files[pathname] = file;
+    return file;
+}
+
+/* Empty files have nothing to map, their contents stay nullptr. */
+std::shared_ptr<const FileCache::MappedFile> FileCache::map(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return nullptr;
+    if (!S_ISREG(st.st_mode)) {
+        errno = ENODEV;
+        return nullptr;
+    }
+
+    auto file = std::make_shared<MappedFile>();
+    file->len = static_cast<uint64_t>(st.st_size);
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim;
+    if (file->len != 0) {
+        void* p = mmap(nullptr, file->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        file->data = static_cast<const char*>(p);
+    }
+    return file;
+}
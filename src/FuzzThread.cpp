@@ -1,27 +1,247 @@
 #include "FuzzThread.h"
+#include "IoRing.h"
 
+#include <unistd.h>
 
-FuzzThread::FuzzThread(Corpus* _corpus, FileInfo* _target, const char** _fuzz_opts, int _n_opts)
+
+/* The buffers handed to the guest outlive it, nothing needs to be released. */
+static std::shared_ptr<const char[]> unowned(const char* data)
+{
+    return std::shared_ptr<const char[]>(std::shared_ptr<const char[]>(), data);
+}
+
+/*
+ * Every worker loads its own copy of the target once and runs it up to main,
+ * or up to the persistent function. The corpus is shared.
+ */
+FuzzThread::FuzzThread(Corpus* _corpus, FileInfo* _target, const char** _fuzz_opts,
+                       int _n_opts, uint64_t _seed, const FuzzConfig& _config)
         : corpus(_corpus)
         , target(_target)
         , fuzz_opts(_fuzz_opts)
         , n_opts(_n_opts)
+        , seed(_seed)
+        , config(_config)
+        , shared_coverage(_config.coverage)
     {
+        golden = std::make_unique<VEmu>(target,
+                                        substitute_input(fuzz_opts, n_opts, INPUT_PATH));
+
+        /*
+         * Start-up code may already read the input before the persistent
+         * function is reached. The buffer is allocated before the guest sets
+         * up its heap, so its brk() calls are unaffected.
+         */
+        std::string_view first = corpus->get(0);
+        golden->set_virtual_file(INPUT_PATH, unowned(first.data()), first.size());
+        uint64_t stop_addr = target->main_addr;
+        if (config.persistent_addr != ~0ULL) {
+            input_addr = golden->allocate_buffer(Mutator::MAX_INPUT_SIZE);
+            stop_addr = config.persistent_addr;
+        }
+
+        /* Without symbols the snapshot is taken at the entry point. */
+        if (stop_addr != ~0ULL && !golden->run_until(stop_addr)) {
+            std::cout << "Target exited before reaching 0x" << std::hex << stop_addr
+                      << std::dec << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        emulator = std::make_unique<VEmu>(*golden);
+        emulator->set_instruction_limit(config.insn_limit);
+        if (shared_coverage != nullptr)
+            emulator->set_coverage(&trace);
+        if (config.cmplog) {
+            emulator->set_cmplog(&cmplog);
+            mutator.set_cmplog(&cmplog);
+        }
+        if (config.output == FuzzConfig::Output::Host) {
+            stdout_sink.emplace(OutputSink::host_fd(STDOUT_FILENO));
+            stderr_sink.emplace(OutputSink::host_fd(STDERR_FILENO));
+            emulator->set_output(&*stdout_sink, &*stderr_sink);
+        } else if (config.output == FuzzConfig::Output::Capture) {
+            stdout_sink.emplace(OutputSink::capture(CAPTURE_SIZE));
+            emulator->set_output(&*stdout_sink, &*stdout_sink);
+        }
+        if (config.dictionary != nullptr) {
+            for (const auto& token : *config.dictionary)
+                mutator.add_token(token);
+        }
     }
 
 
 
+/* Only the owning worker writes its counters, a plain load and store will do. */
+static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
 void FuzzThread::dispatch(uint64_t runs)
 {
+    /* The generator is thread-local, so it is seeded on the worker thread. */
+    seed_rand(seed);
+
     while (runs--) {
-        MutationHistory hist;
-        auto input_info = corpus->get_random_free_file();
-        push_mutate(target, gen_rand() % 8, hist);
-        VEmu em = VEmu { target,
-                         substitute_input(fuzz_opts, n_opts,
-                                          input_info->file_name.c_str()) };
-        pop_mutate(input_info, hist);
-        auto exit_status = em.run();
-        (void)exit_status;
+        if (energy == 0)
+            pick_entry();
+        prepare_input();
+        auto exit_status = execute({ mutator.data(), mutator.size() });
+        bool timed_out = emulator->timed_out();
+        /* Hangs are not worth keeping, they only slow every later run down. */
+        if (shared_coverage != nullptr && !timed_out)
+            update_coverage();
+
+        bump(st.runs);
+        bump(st.instructions, emulator->instructions_retired());
+        if (timed_out) {
+            bump(st.timeouts);
+            save_crash(CrashStore::Kind::Timeout);
+        } else if (exit_status == CRASH_EXIT_CODE) {
+            bump(st.crashes);
+            save_crash(CrashStore::Kind::Crash);
+        }
+
+        current_execs++;
+        current_insns += emulator->instructions_retired();
+        if (--energy == 0)
+            finish_entry();
+    }
+    if (current_execs != 0)
+        finish_entry();
+    if (config.output == FuzzConfig::Output::Host) {
+        stdout_sink->flush();
+        stderr_sink->flush();
+        IoRing::the().drain();
+    }
+}
+
+void FuzzThread::pick_entry()
+{
+    if (config.scheduler != nullptr) {
+        current = config.scheduler->next(energy);
+    } else {
+        current = corpus->random_index();
+        energy = 1;
+    }
+    if (config.taint)
+        analyse_taint();
+}
+
+void FuzzThread::finish_entry()
+{
+    if (config.scheduler != nullptr)
+        config.scheduler->complete(current, current_execs, current_insns, current_finds);
+    energy = 0;
+    current_execs = 0;
+    current_insns = 0;
+    current_finds = 0;
+}
+
+/*
+ * A tainted run of the current entry, the first time this worker picks it.
+ * The offsets it finds steer the byte mutations of the entry from then on.
+ */
+void FuzzThread::analyse_taint()
+{
+    auto it = hot_offsets.find(current);
+    if (it == hot_offsets.end()) {
+        std::string_view input = corpus->get(current);
+        tracker.clear();
+        emulator->set_taint(&tracker);
+        execute(input);
+        emulator->set_taint(nullptr);
+        it = hot_offsets.emplace(current, tracker.hot_offsets(input.size())).first;
     }
+    mutator.set_hot_offsets(it->second);
+}
+
+/* Mutates a copy of the current entry, maybe spliced with a random one. */
+void FuzzThread::prepare_input()
+{
+    std::string_view input = corpus->get(current);
+    mutator.load(input.data(), input.size());
+    if (gen_rand() % SPLICE_CHANCE == 0) {
+        std::string_view other = corpus->get(corpus->random_index());
+        mutator.splice(other.data(), other.size());
+    }
+    mutator.havoc();
+}
+
+uint32_t FuzzThread::execute(std::string_view input)
+{
+    emulator->reset_to(*golden);
+    /* The mutator has drawn on the previous run's log by now. */
+    if (shared_coverage != nullptr)
+        trace.clear();
+    if (config.cmplog)
+        cmplog.clear();
+    if (config.output == FuzzConfig::Output::Capture)
+        stdout_sink->clear();
+
+    uint32_t exit_status;
+    if (input_addr != 0) {
+        exit_status = run_persistent(input);
+    } else {
+        emulator->set_virtual_file(INPUT_PATH, unowned(input.data()), input.size());
+        exit_status = emulator->run();
+    }
+
+    if (shared_coverage != nullptr)
+        trace.classify();
+    return exit_status;
+}
+
+/*
+ * Calls the persistent function on the input. Only the input bytes and the
+ * memory the call writes are dirtied, so the next reset stays cheap.
+ */
+uint32_t FuzzThread::run_persistent(std::string_view input)
+{
+    uint64_t len = std::min<uint64_t>(input.size(), Mutator::MAX_INPUT_SIZE);
+    auto* data = reinterpret_cast<const uint8_t*>(input.data());
+    emulator->patch_memory(input_addr, data, len);
+    emulator->label_input(input_addr, len);
+    emulator->set_ireg(REG_A0, input_addr);
+    emulator->set_ireg(REG_A1, len);
+    emulator->set_ireg(REG_RA, RETURN_ADDR);
+    emulator->run_until(RETURN_ADDR);
+    return emulator->get_exit_code();
+}
+
+std::string FuzzThread::get_output() const
+{
+    if (config.output != FuzzConfig::Output::Capture)
+        return {};
+    return stdout_sink->captured();
+}
+
+/*
+ * Runs that hit new edges or new hit-count buckets are promoted. The private
+ * virgin map filters out almost every run, so the shared map is seldom locked.
+ */
+void FuzzThread::update_coverage()
+{
+    if (virgin.merge(trace) == 0)
+        return;
+    uint32_t new_edges = shared_coverage->merge(trace);
+    if (new_edges == 0)
+        return;
+
+    corpus->promote({ mutator.data(), mutator.size() }, emulator->instructions_retired(),
+                    new_edges);
+    bump(st.new_inputs);
+    current_finds++;
+}
+
+void FuzzThread::save_crash(CrashStore::Kind kind)
+{
+    if (config.crashes == nullptr)
+        return;
+
+    CrashStore::Report report { kind, emulator->stop_site(), emulator->get_fault(),
+                                emulator->instructions_retired(), {} };
+    if (!seen_buckets.insert(CrashStore::bucket(report)).second)
+        return;
+    report.output = get_output();
+    config.crashes->add(report, { mutator.data(), mutator.size() }, *golden);
 }
@@ -3,8 +3,8 @@
 InstructionDecoder::InstructionDecoder() { init_fixed_instrs(); }
 
 /*
- * MRET and SRET have fixed encodings with no parameters. Hence, we don't
- * bother to decode it at all, we just insert its encoding to the decoding
+ * MRET, SRET and WFI have fixed encodings with no parameters. Hence, we don't
+ * bother to decode them at all, we just insert their encodings to the decoding
  * cache.
  */
 void InstructionDecoder::init_fixed_instrs()
@@ -46,11 +46,31 @@ void InstructionDecoder::init_fixed_instrs()
                 },
         "SRET"
     };
+
+    instr_cache[0x10500073] = Instruction {
+        Instruction::Type::R, IName::WFI,
+        Fields {
+                .OPCode = 0b1110011,
+                .rd = 0b00000,
+                .funct3 = 0b000,
+                .rs1 = 0b00000,
+                .rs2 = 0b00101,
+                .funct7 = 0b0001000,
+                .shamt32 = 0,
+                .shamt64 = 0,
+                .funct6 = 0,
+                .imm = 0,
+                .funct2 = 0,
+                .rs3 = 0,
+                },
+        "WFI"
+    };
 }
 
+/* Each thread gets its own decoder, so the decoding cache needs no locking. */
 InstructionDecoder& InstructionDecoder::the()
 {
-    static InstructionDecoder inst;
+    static thread_local InstructionDecoder inst;
     return inst;
 }
 
@@ -183,6 +203,7 @@ const std::map<IName, std::string> InstructionDecoder::inst_string_names = {
 
     { IName::SRET,     "SRET"    },
     { IName::MRET,     "MRET"    },
+    { IName::WFI,      "WFI"     },
 
     { IName::FLW,      "FLW"     },
     { IName::FSW,      "FSW"     },
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <IoRing.h>
+
+/* No liburing, the two syscalls are all it takes. */
+static int io_uring_setup(unsigned entries, io_uring_params* p)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags)
+{
+    return static_cast<int>(
+        syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+template <typename T> static T* at(void* base, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<uint8_t*>(base) + offset);
+}
+
+IoRing& IoRing::the()
+{
+    static IoRing inst;
+    return inst;
+}
+
+IoRing::IoRing()
+{
+    if (!setup() && ring_fd != -1) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+}
+
+IoRing::~IoRing()
+{
+    drain();
+    if (sqes != nullptr)
+        munmap(sqes, sqes_size);
+    if (cq_ring != nullptr && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring != nullptr)
+        munmap(sq_ring, sq_ring_size);
+    if (ring_fd != -1)
+        close(ring_fd);
+}
+
+bool IoRing::setup()
+{
+    io_uring_params p {};
+    ring_fd = io_uring_setup(RING_ENTRIES, &p);
+    /* Writes at the current position are what stdout and pipes need. */
+    if (ring_fd < 0 || (p.features & IORING_FEAT_RW_CUR_POS) == 0) {
+        ring_fd = ring_fd < 0 ? -1 : ring_fd;
+        return false;
+    }
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        sq_ring = nullptr;
+        return false;
+    }
+    cq_ring = sq_ring;
+    if (!single_mmap) {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            cq_ring = nullptr;
+            return false;
+        }
+    }
+    sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = nullptr;
+        return false;
+    }
+
+    sq_tail = at<unsigned>(sq_ring, p.sq_off.tail);
+    sq_mask = at<unsigned>(sq_ring, p.sq_off.ring_mask);
+    sq_array = at<unsigned>(sq_ring, p.sq_off.array);
+    cq_head = at<unsigned>(cq_ring, p.cq_off.head);
+    cq_tail = at<unsigned>(cq_ring, p.cq_off.tail);
+    cq_mask = at<unsigned>(cq_ring, p.cq_off.ring_mask);
+    cqes = at<void>(cq_ring, p.cq_off.cqes);
+    sq_entries = p.sq_entries;
+    return true;
+}
+
+void IoRing::write(int fd, std::vector<uint8_t> data)
+{
+    if (data.empty())
+        return;
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_back({ fd, std::move(data) });
+    if (queue.size() >= BATCH_SIZE)
+        submit_locked();
+}
+
+void IoRing::drain()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    submit_locked();
+}
+
+void IoRing::write_sync(int fd, const uint8_t* data, uint64_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        len -= static_cast<uint64_t>(n);
+    }
+}
+
+/*
+ * Whatever the ring left unwritten, a short write or the rest of a chain it
+ * cut, is finished synchronously in queue order, so the output stays in order.
+ */
+void IoRing::submit_locked()
+{
+    if (queue.empty())
+        return;
+
+    results.assign(queue.size(), RESULT_PENDING);
+    if (has_ring() && queue.size() <= sq_entries && !submit_ring()) {
+        /* A broken ring stays broken, everything after it goes synchronously. */
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    for (size_t i = 0; i < queue.size(); i++) {
+        auto done = static_cast<uint64_t>(std::max<int64_t>(results[i], 0));
+        const auto& r = queue[i];
+        if (done < r.data.size())
+            write_sync(r.fd, r.data.data() + done, r.data.size() - done);
+    }
+    queue.clear();
+}
+
+static bool retryable(int err)
+{
+    return err == EINTR || err == EAGAIN || err == EBUSY;
+}
+
+/*
+ * Submits the queue as one linked chain and waits for what the kernel took.
+ * If it takes only part of the chain, or refuses it, the rest is left to the
+ * synchronous path once everything in flight has completed, so nothing is
+ * written twice or out of order. Returns false if the ring should be dropped.
+ */
+bool IoRing::submit_ring()
+{
+    auto n = static_cast<unsigned>(queue.size());
+    unsigned tail = *sq_tail;
+    for (unsigned i = 0; i < n; i++) {
+        unsigned idx = tail & *sq_mask;
+        auto* sqe = &static_cast<io_uring_sqe*>(sqes)[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = queue[i].fd;
+        sqe->addr = reinterpret_cast<uint64_t>(queue[i].data.data());
+        sqe->len = static_cast<uint32_t>(queue[i].data.size());
+        sqe->off = ~0ULL;
+        sqe->flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+        sqe->user_data = i;
+        sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned submitted = 0;
+    unsigned reaped = 0;
+    bool broken = false;
+    while (reaped < submitted || (!broken && submitted < n)) {
+        unsigned to_submit = broken ? 0 : n - submitted;
+        int ret = io_uring_enter(ring_fd, to_submit, submitted + to_submit - reaped,
+                                 IORING_ENTER_GETEVENTS);
+        if (ret < 0 && !retryable(errno)) {
+            if (to_submit == 0) {
+                strand_in_flight(submitted);
+                return false;
+            }
+            broken = true;
+        } else if (ret >= 0 && to_submit > 0) {
+            submitted += static_cast<unsigned>(ret);
+            broken = static_cast<unsigned>(ret) < to_submit;
+        }
+
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            auto& cqe = static_cast<io_uring_cqe*>(cqes)[head & *cq_mask];
+            if (cqe.user_data < results.size())
+                results[cqe.user_data] = cqe.res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    return !broken;
+}
+
+/*
+ * Completions can no longer be waited for. Writes still in flight may yet
+ * happen, so they are neither repeated nor is their buffer freed.
+ */
+void IoRing::strand_in_flight(unsigned submitted)
+{
+    for (unsigned i = 0; i < submitted; i++) {
+        if (results[i] == RESULT_PENDING)
+            stranded.push_back(std::move(queue[i].data));
+    }
+}
@@ -1,19 +1,159 @@
 #include <MMU.h>
 #include <cassert>
+#include <cstring>
 #include <execution>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Anonymous mappings are zero-filled lazily, untouched guest pages cost nothing. */
+static uint8_t* map_anonymous(uint64_t size)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        std::cout << "Could not allocate " << size << " bytes of guest memory.\n";
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<uint8_t*>(p);
+}
 
 MMU::MMU(uint64_t mem_size)
-    : ram_size(mem_size)
+    : dirty_bitmap((mem_size / BLOCK_SIZE + 63) / 64)
+    , ram_size(mem_size)
+    , page_state(mem_size / GUEST_PAGE_SIZE)
+{
+    ram = map_anonymous(ram_size);
+    byte_permission = map_anonymous(ram_size);
+}
+
+/* The copy starts clean, its dirty blocks are relative to `other`. */
+MMU::MMU(const MMU& other)
+    : Device(other)
+    , dirty_bitmap(other.dirty_bitmap.size())
+    , ram_size(other.ram_size)
+    , alloc_ptr(other.alloc_ptr)
+    , heap_start(other.heap_start)
+    , page_state(other.page_state)
+    , pending_pages(other.pending_pages)
+{
+    ram = map_anonymous(ram_size);
+    byte_permission = map_anonymous(ram_size);
+    memcpy(ram, other.ram, ram_size);
+    memcpy(byte_permission, other.byte_permission, ram_size);
+}
+
+MMU::~MMU()
+{
+    munmap(ram, ram_size);
+    munmap(byte_permission, ram_size);
+    if (labels != nullptr)
+        munmap(labels, ram_size * sizeof(uint32_t));
+}
+
+void MMU::enable_labels()
+{
+    if (labels == nullptr)
+        labels = reinterpret_cast<uint32_t*>(map_anonymous(ram_size * sizeof(uint32_t)));
+}
+
+void MMU::save(SnapshotWriter& w) const
+{
+    w.put(ram_size);
+    w.put(alloc_ptr);
+    w.put(heap_start);
+    w.put(pending_pages);
+    w.put_bytes(page_state.data(), page_state.size());
+}
+
+void MMU::restore(SnapshotReader& r)
+{
+    if (r.get<uint64_t>() != ram_size) {
+        r.fail();
+        return;
+    }
+    alloc_ptr = r.get<uint64_t>();
+    heap_start = r.get<uint64_t>();
+    pending_pages = r.get<uint64_t>();
+    r.get_bytes(page_state.data(), page_state.size());
+}
+
+/*
+ * Writes guest RAM and the permission shadow at the given (page-aligned) file
+ * offsets. All-zero pages are skipped, leaving holes in the file which read back
+ * as zeroes.
+ */
+bool MMU::save_sections(int fd, uint64_t ram_offset, uint64_t perms_offset) const
 {
-    ram.reserve(ram_size);
-    byte_permission.reserve(ram_size);
+    static const uint8_t zero_block[BLOCK_SIZE] = {};
+
+    for (auto [section, offset] : { std::pair { ram, ram_offset },
+                                    std::pair { byte_permission, perms_offset } }) {
+        for (uint64_t addr = 0; addr < ram_size; addr += BLOCK_SIZE) {
+            uint64_t len = std::min(BLOCK_SIZE, ram_size - addr);
+            if (memcmp(section + addr, zero_block, len) == 0)
+                continue;
+            auto written
+                = pwrite(fd, section + addr, len, static_cast<off_t>(offset + addr));
+            if (written != static_cast<ssize_t>(len))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Replaces guest RAM and the permission shadow with private mappings of the
+ * snapshot file. Pages are only read in when touched and are copied on write,
+ * the file itself is never modified.
+ */
+bool MMU::map_sections(int fd, uint64_t ram_offset, uint64_t perms_offset,
+                       uint64_t mem_size)
+{
+    void* new_ram = mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                         static_cast<off_t>(ram_offset));
+    if (new_ram == MAP_FAILED)
+        return false;
+
+    void* new_perms = mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                           static_cast<off_t>(perms_offset));
+    if (new_perms == MAP_FAILED) {
+        munmap(new_ram, mem_size);
+        return false;
+    }
+
+    munmap(ram, ram_size);
+    munmap(byte_permission, ram_size);
+
+    ram = static_cast<uint8_t*>(new_ram);
+    byte_permission = static_cast<uint8_t*>(new_perms);
+    ram_size = mem_size;
+    dirty_bitmap.assign((mem_size / BLOCK_SIZE + 63) / 64, 0);
+    dirty_blocks.clear();
+
+    return true;
 }
 
 void MMU::set_perms(uint64_t addr, uint64_t size, BytePermission perm)
 {
     assert(addr + size < ram_size);
-    std::fill(std::execution::par, byte_permission.begin() + addr,
-              byte_permission.begin() + addr + size, perm);
+    std::fill(std::execution::par, byte_permission + addr, byte_permission + addr + size,
+              perm);
+    mark_dirty(addr, size);
+}
+
+void MMU::mark_dirty(uint64_t addr, uint64_t len)
+{
+    if (len == 0)
+        return;
+
+    for (uint64_t blk = addr / BLOCK_SIZE; blk <= (addr + len - 1) / BLOCK_SIZE; blk++) {
+        uint64_t bit = 1ULL << (blk % 64);
+        if ((dirty_bitmap[blk / 64] & bit) == 0) {
+            dirty_bitmap[blk / 64] |= bit;
+            dirty_blocks.push_back(blk);
+        }
+    }
 }
 
 uint64_t MMU::allocate(uint64_t size)
@@ -21,19 +161,131 @@ uint64_t MMU::allocate(uint64_t size)
     uint64_t base = alloc_ptr;
     assert(size + base < ram_size);
     alloc_ptr += size;
+    heap_start = alloc_ptr;
     set_perms(base, size, PERM_RAW | PERM_WRITE);
     return base;
 }
 
+bool MMU::pages_free(uint64_t first, uint64_t n) const
+{
+    for (uint64_t page = first; page < first + n; page++) {
+        if ((page_state[page] & PAGE_MAPPED) != 0)
+            return false;
+    }
+    return true;
+}
+
+bool MMU::set_break(uint64_t addr)
+{
+    if (addr < heap_start || addr >= ram_size - GUEST_PAGE_SIZE)
+        return false;
+
+    if (addr > alloc_ptr) {
+        uint64_t first = alloc_ptr / GUEST_PAGE_SIZE;
+        if (!pages_free(first, (addr - 1) / GUEST_PAGE_SIZE - first + 1))
+            return false;
+        set_perms(alloc_ptr, addr - alloc_ptr, PERM_RAW | PERM_WRITE);
+    } else if (addr < alloc_ptr) {
+        set_perms(addr, alloc_ptr - addr, 0);
+    }
+    alloc_ptr = addr;
+    return true;
+}
+
+uint64_t MMU::map_pages(uint64_t addr, uint64_t len, BytePermission perms, bool fixed)
+{
+    uint64_t n = (len + GUEST_PAGE_SIZE - 1) / GUEST_PAGE_SIZE;
+    /* Mappings stay above the heap, and off the last page like every access. */
+    uint64_t floor = (alloc_ptr + GUEST_PAGE_SIZE - 1) / GUEST_PAGE_SIZE;
+    uint64_t top = page_state.size() - 1;
+    if (n == 0 || n > top)
+        return 0;
+
+    uint64_t first = 0;
+    if (fixed) {
+        first = addr / GUEST_PAGE_SIZE;
+        if (addr % GUEST_PAGE_SIZE != 0 || first < floor || first + n > top)
+            return 0;
+        unmap_pages(addr, n * GUEST_PAGE_SIZE);
+    } else {
+        /* Top-down first fit, a run of free pages is counted from its end. */
+        uint64_t run = 0;
+        for (uint64_t page = top; page-- > floor;) {
+            run = (page_state[page] & PAGE_MAPPED) != 0 ? 0 : run + 1;
+            if (run == n) {
+                first = page;
+                break;
+            }
+        }
+        if (run != n)
+            return 0;
+    }
+
+    auto state = static_cast<uint8_t>(PAGE_MAPPED | PAGE_PENDING | perms);
+    std::fill_n(page_state.begin() + static_cast<int64_t>(first), n, state);
+    pending_pages += n;
+    pages_changed = true;
+    return first * GUEST_PAGE_SIZE;
+}
+
+void MMU::unmap_pages(uint64_t addr, uint64_t len)
+{
+    uint64_t first = addr / GUEST_PAGE_SIZE;
+    uint64_t end = (addr + len + GUEST_PAGE_SIZE - 1) / GUEST_PAGE_SIZE;
+    end = std::min<uint64_t>(end, page_state.size());
+    for (uint64_t page = first; page < end; page++) {
+        uint8_t& state = page_state[page];
+        if ((state & PAGE_MAPPED) == 0)
+            continue;
+        if ((state & PAGE_PENDING) != 0)
+            pending_pages--;
+        else
+            set_perms(page * GUEST_PAGE_SIZE, GUEST_PAGE_SIZE, 0);
+        state = 0;
+        pages_changed = true;
+    }
+}
+
+void MMU::materialize(uint64_t addr, uint64_t len)
+{
+    uint64_t last = (addr + std::max<uint64_t>(len, 1) - 1) / GUEST_PAGE_SIZE;
+    for (uint64_t page = addr / GUEST_PAGE_SIZE; page <= last; page++) {
+        uint8_t& state = page_state[page];
+        if ((state & PAGE_PENDING) == 0)
+            continue;
+        uint64_t base = page * GUEST_PAGE_SIZE;
+        memset(ram + base, 0, GUEST_PAGE_SIZE);
+        BytePermission perms = state & (PERM_READ | PERM_WRITE | PERM_EXEC);
+        std::fill_n(byte_permission + base, GUEST_PAGE_SIZE, perms);
+        mark_dirty(base, GUEST_PAGE_SIZE);
+        state &= static_cast<uint8_t>(~PAGE_PENDING);
+        pending_pages--;
+        pages_changed = true;
+    }
+}
+
 void MMU::reset_to(const MMU& other)
 {
+    assert(ram_size == other.ram_size);
+
     for (auto blk : dirty_blocks) {
         uint64_t start_addr = blk * BLOCK_SIZE;
-        for (uint64_t i = start_addr; i < start_addr + BLOCK_SIZE; i++) {
-            ram[i] = other.ram[i];
-        }
+        uint64_t len = std::min(BLOCK_SIZE, ram_size - start_addr);
+        memcpy(ram + start_addr, other.ram + start_addr, len);
+        memcpy(byte_permission + start_addr, other.byte_permission + start_addr, len);
+        if (labels_written)
+            memset(labels + start_addr, 0, len * sizeof(uint32_t));
+        dirty_bitmap[blk / 64] = 0;
     }
     dirty_blocks.clear();
+    labels_written = false;
+    alloc_ptr = other.alloc_ptr;
+    heap_start = other.heap_start;
+    if (pages_changed) {
+        page_state = other.page_state;
+        pending_pages = other.pending_pages;
+        pages_changed = false;
+    }
 }
 
 void MMU::load_file(FileInfo* info)
@@ -53,35 +305,49 @@ void MMU::load_file(FileInfo* info)
             alloc_ptr,
             (uint64_t)(((seg.start_addr + seg.mem_size) + 0xFFFFULL) & ~0xFFFFULL));
     }
+    heap_start = alloc_ptr;
+}
+
+ReturnException MMU::write_from(const std::vector<uint8_t>& buf, uint64_t start_addr)
+{
+    return write_from(buf.data(), buf.size(), start_addr);
 }
 
-void MMU::write_from(const std::vector<uint8_t>& buf, uint64_t start_addr)
+/* Faulting writes leave memory untouched. */
+ReturnException MMU::write_from(const uint8_t* src, uint64_t len, uint64_t start_addr)
 {
-    assert(start_addr + buf.size() < ram_size);
+    if (start_addr >= ram_size || len >= ram_size - start_addr)
+        return ReturnException::StoreAMOAccessFault;
+    fault_in(start_addr, len);
     bool can_write_all = true;
-    for (uint64_t i = start_addr; i < start_addr + buf.size(); i++) {
+    for (uint64_t i = start_addr; i < start_addr + len; i++) {
         can_write_all &= ((byte_permission[i] & PERM_WRITE) != 0);
     }
+    if (!can_write_all)
+        return ReturnException::StoreAMOAccessFault;
 
-    // TODO: Handle memory write errors gracefully.
-    assert(can_write_all);
-
-    for (uint64_t i = start_addr; i < start_addr + buf.size(); i++) {
-        ram[i] = buf[i - start_addr];
+    memcpy(ram + start_addr, src, len);
+    for (uint64_t i = start_addr; i < start_addr + len; i++) {
         if ((byte_permission[i] & PERM_RAW) != 0) {
             byte_permission[i] |= PERM_READ;
             byte_permission[i] &= ~PERM_RAW;
         }
     }
+    mark_dirty(start_addr, len);
+    return ReturnException::NormalExecutionReturn;
 }
 
 std::pair<std::vector<uint8_t>, ReturnException> MMU::read_to(uint64_t start_addr,
-                                                              uint64_t len) const
+                                                              uint64_t len)
 {
-    assert(start_addr + len < ram_size);
+    /* Checked before allocating, `len` may come straight from the guest. */
+    if (!in_ram(start_addr, len))
+        return { {}, ReturnException::LoadAccessFault };
+
     std::pair<std::vector<uint8_t>, ReturnException> ret {
         std::vector<uint8_t>(len), ReturnException::NormalExecutionReturn
     };
+    fault_in(start_addr, len);
 
     bool can_read_all = true;
     bool has_raw = false;
@@ -132,40 +398,39 @@ ReturnException MMU::store(uint64_t addr, uint64_t data, size_t sz)
 {
     switch (sz) {
     case 8:
-        store_byte(addr, data);
-        break;
+        return store_byte(addr, data);
     case 16:
-        store_hword(addr, data);
-        break;
+        return store_hword(addr, data);
     case 32:
-        store_word(addr, data);
-        break;
+        return store_word(addr, data);
     case 64:
-        store_dword(addr, data);
-        break;
+        return store_dword(addr, data);
     default:
         assert(false);
     }
 
-    uint64_t block_idx = addr / BLOCK_SIZE;
-    dirty_blocks.insert(block_idx);
-
     return ReturnException::NormalExecutionReturn;
 }
 
-[[nodiscard]] std::string MMU::_read_null_terminated_string(uint64_t addr) const
+[[nodiscard]] std::string MMU::_read_null_terminated_string(uint64_t addr)
 {
     std::string str;
-    uint8_t read_char = ' ';
-    while (read_char != 0) {
-        read_char = read_to(addr++, 1).first[0];
-        str += read_char;
+    for (;;) {
+        auto [read_data, exp] = read_to(addr++, 1);
+        if (read_data.empty() || read_data[0] == 0)
+            return str;
+        str += static_cast<char>(read_data[0]);
     }
-    return str;
 }
 
-std::pair<uint32_t, ReturnException> MMU::load_insn(uint64_t addr) const
+std::pair<uint32_t, ReturnException> MMU::load_insn(uint64_t addr)
 {
+    if (addr >= ram_size - 4)
+        return { 0, ReturnException::InstructionAccessFault };
+    fault_in(addr, 4);
+    if ((byte_permission[addr] & PERM_EXEC) == 0)
+        return { 0, ReturnException::InstructionAccessFault };
+
     uint64_t res = 0x00000000;
 
     res |= static_cast<uint64_t>(ram[addr + 0]);
@@ -176,32 +441,55 @@ std::pair<uint32_t, ReturnException> MMU::load_insn(uint64_t addr) const
     return { res, ReturnException::NormalExecutionReturn };
 }
 
-std::pair<uint64_t, ReturnException> MMU::load_byte(uint64_t addr) const
+bool MMU::dma_read(uint64_t addr, uint8_t* dst, uint64_t len) const
+{
+    if (!in_ram(addr, len))
+        return false;
+    std::copy_n(ram + addr, len, dst);
+    return true;
+}
+
+bool MMU::dma_write(uint64_t addr, const uint8_t* src, uint64_t len)
+{
+    if (!in_ram(addr, len))
+        return false;
+    std::copy_n(src, len, ram + addr);
+    mark_dirty(addr, len);
+    return true;
+}
+
+std::pair<uint64_t, ReturnException> MMU::load_byte(uint64_t addr)
 {
     uint64_t res = 0x00000000;
 
     auto [read_data, exp] = read_to(addr, 1);
+    if (read_data.empty())
+        return { 0, exp };
     res |= static_cast<uint64_t>(read_data[0]);
 
     return { res, exp };
 }
 
-std::pair<uint64_t, ReturnException> MMU::load_hword(uint64_t addr) const
+std::pair<uint64_t, ReturnException> MMU::load_hword(uint64_t addr)
 {
     uint64_t res = 0x00000000;
 
     auto [read_data, exp] = read_to(addr, 2);
+    if (read_data.empty())
+        return { 0, exp };
     res |= static_cast<uint64_t>(read_data[0]);
     res |= static_cast<uint64_t>(read_data[1]) << 8;
 
     return { res, exp };
 }
 
-std::pair<uint64_t, ReturnException> MMU::load_word(uint64_t addr) const
+std::pair<uint64_t, ReturnException> MMU::load_word(uint64_t addr)
 {
     uint64_t res = 0x00000000;
 
     auto [read_data, exp] = read_to(addr, 4);
+    if (read_data.empty())
+        return { 0, exp };
     res |= static_cast<uint64_t>(read_data[0]);
     res |= static_cast<uint64_t>(read_data[1]) << 8;
     res |= static_cast<uint64_t>(read_data[2]) << 16;
@@ -210,11 +498,13 @@ std::pair<uint64_t, ReturnException> MMU::load_word(uint64_t addr) const
     return { res, exp };
 }
 
-std::pair<uint64_t, ReturnException> MMU::load_dword(uint64_t addr) const
+std::pair<uint64_t, ReturnException> MMU::load_dword(uint64_t addr)
 {
     uint64_t res = 0x00000000;
 
     auto [read_data, exp] = read_to(addr, 8);
+    if (read_data.empty())
+        return { 0, exp };
     res |= static_cast<uint64_t>(read_data[0]);
     res |= static_cast<uint64_t>(read_data[1]) << 8;
     res |= static_cast<uint64_t>(read_data[2]) << 16;
@@ -227,32 +517,32 @@ std::pair<uint64_t, ReturnException> MMU::load_dword(uint64_t addr) const
     return { res, exp };
 }
 
-void MMU::store_byte(uint64_t addr, uint64_t data)
+ReturnException MMU::store_byte(uint64_t addr, uint64_t data)
 {
     std::vector<uint8_t> data_to_store(1);
     data_to_store[0] = static_cast<uint8_t>(data);
-    write_from(data_to_store, addr);
+    return write_from(data_to_store, addr);
 }
 
-void MMU::store_hword(uint64_t addr, uint64_t data)
+ReturnException MMU::store_hword(uint64_t addr, uint64_t data)
 {
     std::vector<uint8_t> data_to_store(2);
     data_to_store[0] = static_cast<uint8_t>(data) & 0xFF;
     data_to_store[1] = static_cast<uint8_t>((data >> 8) & 0xFF);
-    write_from(data_to_store, addr);
+    return write_from(data_to_store, addr);
 }
 
-void MMU::store_word(uint64_t addr, uint64_t data)
+ReturnException MMU::store_word(uint64_t addr, uint64_t data)
 {
     std::vector<uint8_t> data_to_store(4);
     data_to_store[0] = static_cast<uint8_t>(data) & 0xFF;
     data_to_store[1] = static_cast<uint8_t>((data >> 8) & 0xFF);
     data_to_store[2] = static_cast<uint8_t>((data >> 16) & 0xFF);
     data_to_store[3] = static_cast<uint8_t>((data >> 24) & 0xFF);
-    write_from(data_to_store, addr);
+    return write_from(data_to_store, addr);
 }
 
-void MMU::store_dword(uint64_t addr, uint64_t data)
+ReturnException MMU::store_dword(uint64_t addr, uint64_t data)
 {
     std::vector<uint8_t> data_to_store(8);
     data_to_store[0] = static_cast<uint8_t>(data) & 0xFF;
@@ -263,5 +553,5 @@ void MMU::store_dword(uint64_t addr, uint64_t data)
     data_to_store[5] = static_cast<uint8_t>((data >> 40) & 0xFF);
     data_to_store[6] = static_cast<uint8_t>((data >> 48) & 0xFF);
     data_to_store[7] = static_cast<uint8_t>((data >> 56) & 0xFF);
-    write_from(data_to_store, addr);
+    return write_from(data_to_store, addr);
 }
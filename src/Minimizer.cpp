@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include <Minimizer.h>
+
+/* A (map byte, hit-count bucket) pair, classified bytes have a single bit set. */
+static constexpr uint32_t TUPLES_NUM = COVERAGE_MAP_SIZE * 8;
+static constexpr uint32_t NO_ENTRY = ~0U;
+
+Minimizer::Minimizer(const Corpus* _corpus,
+                     std::vector<std::unique_ptr<FuzzThread>>& _workers)
+    : corpus(_corpus)
+    , workers(_workers)
+{
+}
+
+void Minimizer::for_each_entry(const std::function<void(FuzzThread&, size_t)>& fn)
+{
+    size_t n = corpus->size();
+    std::atomic<size_t> next { 0 };
+    std::vector<std::thread> threads;
+    for (auto& w : workers) {
+        threads.emplace_back([&, worker = w.get()]() {
+            for (size_t idx; (idx = next.fetch_add(1)) < n;)
+                fn(*worker, idx);
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+}
+
+Minimizer::signature Minimizer::run(FuzzThread& worker, std::string_view input)
+{
+    uint32_t exit_status = worker.execute(input);
+    return { worker.get_trace().hash(), exit_status, worker.timed_out() };
+}
+
+bool Minimizer::write_entry(const std::string& out_dir, size_t idx,
+                            std::string_view data) const
+{
+    auto path = std::filesystem::path(out_dir)
+        / std::filesystem::path(corpus->path(idx)).filename();
+    std::ofstream file(path, std::ios::binary);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+/*
+ * Greedy, like afl-cmin: every tuple is credited to the smallest entry that
+ * reaches it, then tuples not yet covered pull in their entry.
+ */
+void Minimizer::cmin(const std::string& out_dir)
+{
+    size_t n = corpus->size();
+    std::vector<std::vector<uint32_t>> tuples(n);
+    std::vector<uint8_t> usable(n, 0);
+
+    for_each_entry([&](FuzzThread& worker, size_t idx) {
+        signature sig = run(worker, corpus->get(idx));
+        if (sig.timed_out || sig.exit_status == FuzzThread::CRASH_EXIT_CODE)
+            return;
+        const uint8_t* map = worker.get_trace().data();
+        for (uint32_t i = 0; i < COVERAGE_MAP_SIZE; i++) {
+            if (map[i] != 0) {
+                auto bucket = static_cast<uint32_t>(__builtin_ctz(map[i]));
+                tuples[idx].push_back(i * 8 + bucket);
+            }
+        }
+        usable[idx] = 1;
+    });
+
+    std::vector<uint32_t> best(TUPLES_NUM, NO_ENTRY);
+    for (size_t idx = 0; idx < n; idx++) {
+        if (!usable[idx])
+            continue;
+        uint64_t size = corpus->meta(idx).size.load(std::memory_order_relaxed);
+        for (uint32_t t : tuples[idx]) {
+            if (best[t] == NO_ENTRY
+                || size < corpus->meta(best[t]).size.load(std::memory_order_relaxed))
+                best[t] = static_cast<uint32_t>(idx);
+        }
+    }
+
+    std::filesystem::create_directories(out_dir);
+    std::vector<bool> covered(TUPLES_NUM, false);
+    size_t kept = 0;
+    size_t n_tuples = 0;
+    for (uint32_t t = 0; t < TUPLES_NUM; t++) {
+        if (best[t] == NO_ENTRY || covered[t])
+            continue;
+        for (uint32_t u : tuples[best[t]]) {
+            n_tuples += !covered[u];
+            covered[u] = true;
+        }
+        if (!write_entry(out_dir, best[t], corpus->get(best[t]))) {
+            std::cout << "Could not write to " << out_dir << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        kept++;
+    }
+
+    size_t skipped = static_cast<size_t>(std::count(usable.begin(), usable.end(), 0));
+    std::cout << "cmin: kept " << kept << " of " << n << " inputs covering " << n_tuples
+              << " tuples, " << skipped << " crashed or hung" << std::endl;
+}
+
+void Minimizer::tmin(const std::string& out_dir)
+{
+    std::filesystem::create_directories(out_dir);
+    std::atomic<uint64_t> bytes_before { 0 };
+    std::atomic<uint64_t> bytes_after { 0 };
+    std::atomic<bool> write_failed { false };
+
+    for_each_entry([&](FuzzThread& worker, size_t idx) {
+        std::string_view input = corpus->get(idx);
+        signature ref = run(worker, input);
+        auto keeps = [&worker, &ref](std::string_view candidate) {
+            return run(worker, candidate) == ref;
+        };
+        std::string trimmed
+            = ref.timed_out ? std::string(input) : trim(std::string(input), keeps);
+        if (!write_entry(out_dir, idx, trimmed))
+            write_failed = true;
+        bytes_before += input.size();
+        bytes_after += trimmed.size();
+    });
+
+    if (write_failed) {
+        std::cout << "Could not write to " << out_dir << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "tmin: " << corpus->size() << " inputs trimmed from " << bytes_before
+              << " to " << bytes_after << " bytes" << std::endl;
+}
+
+/*
+ * First the shortest prefix that `keeps` accepts, found by bisection, then
+ * blocks of halving size are cut out wherever it accepts that as well.
+ */
+std::string Minimizer::trim(std::string input,
+                            const std::function<bool(std::string_view)>& keeps)
+{
+    uint64_t lo = 0;
+    uint64_t hi = input.size();
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (keeps(std::string_view(input).substr(0, mid)))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    input.resize(hi);
+
+    std::string candidate;
+    uint64_t block = std::max<uint64_t>(1, input.size() / 16);
+    uint64_t min_block = std::max<uint64_t>(1, input.size() / TRIM_MIN_STEPS);
+    for (; block >= min_block && !input.empty(); block /= 2) {
+        for (uint64_t pos = 0; pos < input.size();) {
+            candidate.assign(input, 0, pos);
+            candidate.append(input, std::min<uint64_t>(pos + block, input.size()));
+            if (keeps(candidate))
+                input.swap(candidate);
+            else
+                pos += block;
+        }
+    }
+
+    return input;
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <Mutator.h>
+#include <util.h>
+
+/* Boundary values that tend to trip size and sign checks. */
+static constexpr std::array<int8_t, 9> INTERESTING_8 {
+    -128, -1, 0, 1, 16, 32, 64, 100, 127,
+};
+static constexpr std::array<int16_t, 10> INTERESTING_16 {
+    -32768, -129, 128, 255, 256, 512, 1000, 1024, 4096, 32767,
+};
+static constexpr std::array<int32_t, 8> INTERESTING_32 {
+    INT32_MIN, -100663046, -32769, 32768, 65535, 65536, 100663045, INT32_MAX,
+};
+
+Mutator::Mutator()
+    : buf(new uint8_t[MAX_INPUT_SIZE])
+{
+}
+
+void Mutator::load(const char* data, uint64_t data_len)
+{
+    len = std::min(data_len, MAX_INPUT_SIZE);
+    memcpy(buf.get(), data, len);
+}
+
+void Mutator::havoc()
+{
+    uint64_t stack = 1ULL << (1 + gen_rand() % MAX_STACK_POW2);
+    while (stack--)
+        apply(static_cast<Op>(gen_rand() % static_cast<uint64_t>(Op::OpsNum)));
+}
+
+void Mutator::splice(const char* other, uint64_t other_len)
+{
+    if (len < 2 || other_len < 2)
+        return;
+
+    uint64_t cut = 1 + gen_rand() % (std::min(len, other_len) - 1);
+    len = std::min(other_len, MAX_INPUT_SIZE);
+    memcpy(buf.get() + cut, other + cut, len - cut);
+}
+
+void Mutator::add_token(const std::string& token)
+{
+    if (token.empty() || token.size() > MAX_BLOCK_SIZE)
+        return;
+
+    tokens.emplace_back(static_cast<uint32_t>(token_bytes.size()),
+                        static_cast<uint32_t>(token.size()));
+    token_bytes.insert(token_bytes.end(), token.begin(), token.end());
+}
+
+template <typename T> void Mutator::write_int(uint64_t pos, T value)
+{
+    /* Either byte order, the target's is not known. */
+    if (gen_rand() & 1)
+        value = static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(value))
+                               >> (64 - 8 * sizeof(T)));
+    memcpy(buf.get() + pos, &value, sizeof(T));
+}
+
+template <typename T> T Mutator::read_int(uint64_t pos) const
+{
+    T value;
+    memcpy(&value, buf.get() + pos, sizeof(T));
+    return value;
+}
+
+/* Favors short blocks, long ones mostly destroy the structure of the input. */
+uint64_t Mutator::random_block_len(uint64_t limit) const
+{
+    uint64_t cap = gen_rand() % 4 == 0 ? MAX_BLOCK_SIZE : 32;
+    uint64_t max_len = std::min(limit, cap);
+    return max_len == 0 ? 0 : 1 + gen_rand() % max_len;
+}
+
+bool Mutator::make_room(uint64_t pos, uint64_t n)
+{
+    if (n == 0 || len + n > MAX_INPUT_SIZE)
+        return false;
+
+    memmove(buf.get() + pos + n, buf.get() + pos, len - pos);
+    len += n;
+    return true;
+}
+
+void Mutator::erase(uint64_t pos, uint64_t n)
+{
+    memmove(buf.get() + pos, buf.get() + pos + n, len - pos - n);
+    len -= n;
+}
+
+/* Bytes needed to hold `v`, zero- or sign-extended the way a load would. */
+static uint64_t operand_width(uint64_t v)
+{
+    for (uint64_t w = 1; w < 8; w *= 2) {
+        uint64_t shift = 64 - 8 * w;
+        auto sext = static_cast<uint64_t>(static_cast<int64_t>(v << shift) >> shift);
+        if (v >> (8 * w) == 0 || v == sext)
+            return w;
+    }
+    return 8;
+}
+
+void Mutator::replace_operand()
+{
+    if (cmplog == nullptr || cmplog->size() == 0)
+        return;
+
+    auto idx = static_cast<uint32_t>(gen_rand() % cmplog->size());
+    const CmpLog::Entry& e = (*cmplog)[idx];
+    uint64_t from = e.op1;
+    uint64_t to = e.op2;
+    if (gen_rand() & 1)
+        std::swap(from, to);
+    /* Ordered comparisons are often off by one from what gets them through. */
+    if (gen_rand() % 4 == 0)
+        to += gen_rand() & 1 ? 1 : ~0ULL;
+
+    uint64_t w = std::max(operand_width(from), operand_width(to));
+    if (w > len)
+        return;
+    bool swap_bytes = (gen_rand() & 1) != 0;
+    if (swap_bytes) {
+        from = __builtin_bswap64(from) >> (64 - 8 * w);
+        to = __builtin_bswap64(to) >> (64 - 8 * w);
+    }
+
+    /* The scan starts at a random offset, so repeated hits spread out. */
+    uint64_t mask = w == 8 ? ~0ULL : (1ULL << (8 * w)) - 1;
+    uint64_t positions = len - w + 1;
+    uint64_t start = gen_rand() % positions;
+    uint64_t pos = gen_rand() % positions;
+    for (uint64_t i = 0; i < positions; i++) {
+        uint64_t p = start + i < positions ? start + i : start + i - positions;
+        uint64_t v = 0;
+        memcpy(&v, buf.get() + p, w);
+        if (v == (from & mask)) {
+            pos = p;
+            break;
+        }
+    }
+    memcpy(buf.get() + pos, &to, w);
+}
+
+uint64_t Mutator::random_pos(uint64_t width) const
+{
+    if (!hot.empty() && (gen_rand() & 1) != 0) {
+        uint64_t pos = hot[gen_rand() % hot.size()];
+        if (pos + width <= len)
+            return pos;
+    }
+    return gen_rand() % (len - width + 1);
+}
+
+void Mutator::apply(Op op)
+{
+    /* An empty input can only grow. */
+    if (len == 0 && op != Op::InsertBlock && op != Op::InsertToken)
+        op = Op::InsertBlock;
+
+    switch (op) {
+    case Op::FlipBit: {
+        buf[random_pos(1)] ^= static_cast<uint8_t>(1 << (gen_rand() % 8));
+        break;
+    }
+    case Op::Interesting8:
+        buf[random_pos(1)]
+            = static_cast<uint8_t>(INTERESTING_8[gen_rand() % INTERESTING_8.size()]);
+        break;
+    case Op::Interesting16:
+        if (len >= 2) {
+            auto value = INTERESTING_16[gen_rand() % INTERESTING_16.size()];
+            write_int(random_pos(2), static_cast<uint16_t>(value));
+        }
+        break;
+    case Op::Interesting32:
+        if (len >= 4) {
+            auto value = INTERESTING_32[gen_rand() % INTERESTING_32.size()];
+            write_int(random_pos(4), static_cast<uint32_t>(value));
+        }
+        break;
+    case Op::RandomByte:
+        /* XOR with a non-zero value, so the byte always changes. */
+        buf[random_pos(1)] ^= static_cast<uint8_t>(1 + gen_rand() % 255);
+        break;
+    case Op::Arith8: {
+        auto delta = static_cast<uint8_t>(1 + gen_rand() % ARITH_MAX);
+        auto& byte = buf[random_pos(1)];
+        byte = static_cast<uint8_t>(gen_rand() & 1 ? byte + delta : byte - delta);
+        break;
+    }
+    case Op::Arith16:
+        if (len >= 2) {
+            uint64_t pos = random_pos(2);
+            auto delta = static_cast<uint16_t>(1 + gen_rand() % ARITH_MAX);
+            auto value = read_int<uint16_t>(pos);
+            value = static_cast<uint16_t>(gen_rand() & 1 ? value + delta : value - delta);
+            memcpy(buf.get() + pos, &value, sizeof(value));
+        }
+        break;
+    case Op::Arith32:
+        if (len >= 4) {
+            uint64_t pos = random_pos(4);
+            auto delta = static_cast<uint32_t>(1 + gen_rand() % ARITH_MAX);
+            auto value = read_int<uint32_t>(pos);
+            value = gen_rand() & 1 ? value + delta : value - delta;
+            memcpy(buf.get() + pos, &value, sizeof(value));
+        }
+        break;
+    case Op::DeleteBlock:
+        if (len >= 2) {
+            uint64_t n = random_block_len(len - 1);
+            erase(gen_rand() % (len - n + 1), n);
+        }
+        break;
+    case Op::CloneBlock: {
+        uint64_t n = random_block_len(len);
+        uint64_t from = gen_rand() % (len - n + 1);
+        uint64_t to = gen_rand() % (len + 1);
+        if (make_room(to, n)) {
+            /* The source block may have moved up with the gap. */
+            uint64_t src = from >= to ? from + n : from;
+            memmove(buf.get() + to, buf.get() + src, n);
+        }
+        break;
+    }
+    case Op::InsertBlock: {
+        uint64_t n = random_block_len(MAX_BLOCK_SIZE);
+        uint64_t to = gen_rand() % (len + 1);
+        /* Either a run of an existing byte or of a random one. */
+        auto value = static_cast<uint8_t>(gen_rand());
+        if (len > 0 && (gen_rand() & 1) != 0)
+            value = buf[gen_rand() % len];
+        if (make_room(to, n))
+            memset(buf.get() + to, value, n);
+        break;
+    }
+    case Op::OverwriteBlock:
+        if (len >= 2) {
+            uint64_t n = random_block_len(len - 1);
+            uint64_t from = gen_rand() % (len - n + 1);
+            uint64_t to = gen_rand() % (len - n + 1);
+            memmove(buf.get() + to, buf.get() + from, n);
+        }
+        break;
+    case Op::OverwriteToken:
+        if (!tokens.empty()) {
+            const auto& [off, n] = tokens[gen_rand() % tokens.size()];
+            if (n <= len)
+                memcpy(buf.get() + random_pos(n), &token_bytes[off], n);
+        }
+        break;
+    case Op::InsertToken:
+        if (!tokens.empty()) {
+            const auto& [off, n] = tokens[gen_rand() % tokens.size()];
+            uint64_t to = gen_rand() % (len + 1);
+            if (make_room(to, n))
+                memcpy(buf.get() + to, &token_bytes[off], n);
+        }
+        break;
+    case Op::ReplaceOperand:
+        replace_operand();
+        break;
+    case Op::OpsNum:
+    default:
+        break;
+    }
+}
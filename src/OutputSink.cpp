@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cstring>
+
+#include <IoRing.h>
+#include <OutputSink.h>
+
+OutputSink::OutputSink(Kind _kind, int _fd, uint64_t capacity)
+    : kind(_kind)
+    , fd(_fd)
+    , buf(capacity)
+{
+    if (kind == Kind::HostFd)
+        buf.reserve(FLUSH_THRESHOLD);
+}
+
+OutputSink::OutputSink(OutputSink&& other) noexcept
+    : kind(other.kind)
+    , fd(other.fd)
+    , buf(std::move(other.buf))
+    , written(other.written)
+{
+    other.buf.clear();
+}
+
+OutputSink::~OutputSink() { flush(); }
+
+void OutputSink::write(const uint8_t* data, uint64_t len)
+{
+    switch (kind) {
+    case Kind::HostFd:
+        buf.insert(buf.end(), data, data + len);
+        if (buf.size() >= FLUSH_THRESHOLD)
+            flush();
+        break;
+    case Kind::Capture: {
+        uint64_t size = buf.size();
+        if (size == 0)
+            break;
+        /* Only the tail of a write larger than the ring survives. */
+        if (len > size) {
+            data += len - size;
+            written += len - size;
+            len = size;
+        }
+        uint64_t at = written % size;
+        uint64_t first = std::min(len, size - at);
+        memcpy(buf.data() + at, data, first);
+        memcpy(buf.data(), data + first, len - first);
+        written += len;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* The batch goes to the shared ring, which writes it along with other sinks'. */
+void OutputSink::flush()
+{
+    if (kind != Kind::HostFd || buf.empty())
+        return;
+
+    IoRing::the().write(fd, std::move(buf));
+    buf = {};
+    buf.reserve(FLUSH_THRESHOLD);
+}
+
+void OutputSink::clear()
+{
+    if (kind == Kind::Capture)
+        written = 0;
+}
+
+std::string OutputSink::captured() const
+{
+    if (kind != Kind::Capture || buf.empty())
+        return {};
+
+    uint64_t size = buf.size();
+    if (written <= size)
+        return { buf.begin(), buf.begin() + static_cast<int64_t>(written) };
+    uint64_t at = written % size;
+    std::string out(buf.begin() + static_cast<int64_t>(at), buf.end());
+    out.append(buf.begin(), buf.begin() + static_cast<int64_t>(at));
+    return out;
+}
@@ -2,10 +2,13 @@
 
 PLIC::PLIC()
 {
-    pending = 0;
-    senable = 0;
-    spriority = 0;
-    sclaim = 0;
+    priority.fill(0);
+    pending.fill(0);
+    in_flight.fill(0);
+    for (auto& e : enable)
+        e.fill(0);
+    threshold.fill(0);
+    eip.fill(false);
 }
 
 std::pair<uint64_t, ReturnException> PLIC::load(uint64_t addr, size_t sz)
@@ -14,8 +17,12 @@ std::pair<uint64_t, ReturnException> PLIC::load(uint64_t addr, size_t sz)
     res.second = ReturnException::NormalExecutionReturn;
 
     switch (sz) {
+    case 32:
+        res.first = load32(addr);
+        break;
     case 64:
-        res.first = load64(addr);
+        res.first = load32(addr);
+        res.first |= static_cast<uint64_t>(load32(addr + 4)) << 32;
         break;
     default:
         res.second = ReturnException::LoadAccessFault;
@@ -31,8 +38,12 @@ ReturnException PLIC::store(uint64_t addr, uint64_t value, size_t sz)
     res = ReturnException::NormalExecutionReturn;
 
     switch (sz) {
+    case 32:
+        store32(addr, static_cast<uint32_t>(value));
+        break;
     case 64:
-        store64(addr, value);
+        store32(addr, static_cast<uint32_t>(value));
+        store32(addr + 4, static_cast<uint32_t>(value >> 32));
         break;
     default:
         res = ReturnException::StoreAMOAccessFault;
@@ -42,40 +53,169 @@ ReturnException PLIC::store(uint64_t addr, uint64_t value, size_t sz)
     return res;
 }
 
-uint64_t PLIC::load64(uint64_t addr) const
+void PLIC::save(SnapshotWriter& w) const
 {
-    switch (addr) {
-    case PLIC_PENDING:
-        return pending;
-    case PLIC_SENABLE:
-        return senable;
-    case PLIC_SPRIORITY:
-        return spriority;
-    case PLIC_SCLAIM:
-        return sclaim;
-    default:
-        break;
+    w.put(priority);
+    w.put(pending);
+    w.put(in_flight);
+    w.put(enable);
+    w.put(threshold);
+}
+
+void PLIC::restore(SnapshotReader& r)
+{
+    priority = r.get<decltype(priority)>();
+    pending = r.get<Bitset>();
+    in_flight = r.get<Bitset>();
+    enable = r.get<decltype(enable)>();
+    threshold = r.get<decltype(threshold)>();
+    update_all();
+}
+
+void PLIC::raise(uint32_t irq)
+{
+    if (irq == 0 || irq >= SOURCES_NUM)
+        return;
+
+    uint64_t bit = 1ULL << (irq % 64);
+    uint32_t w = irq / 64;
+
+    /* The gateway holds further requests until the in-flight one completes. */
+    if ((in_flight[w] & bit) != 0 || (pending[w] & bit) != 0)
+        return;
+
+    pending[w] |= bit;
+    update_all();
+}
+
+uint32_t PLIC::best_candidate(uint32_t context) const
+{
+    uint32_t best_irq = 0;
+    uint32_t best_priority = threshold[context];
+
+    for (uint32_t w = 0; w < WORDS_NUM; w++) {
+        uint64_t candidates = pending[w] & enable[context][w];
+        while (candidates != 0) {
+            uint32_t irq = w * 64 + static_cast<uint32_t>(__builtin_ctzll(candidates));
+            candidates &= candidates - 1;
+            if (priority[irq] > best_priority) {
+                best_priority = priority[irq];
+                best_irq = irq;
+            }
+        }
+    }
+
+    return best_irq;
+}
+
+void PLIC::update(uint32_t context) { eip[context] = best_candidate(context) != 0; }
+
+void PLIC::update_all()
+{
+    for (uint32_t ctx = 0; ctx < CONTEXTS_NUM; ctx++)
+        update(ctx);
+}
+
+uint32_t PLIC::claim(uint32_t context)
+{
+    uint32_t irq = best_candidate(context);
+    if (irq != 0) {
+        uint64_t bit = 1ULL << (irq % 64);
+        pending[irq / 64] &= ~bit;
+        in_flight[irq / 64] |= bit;
+        update_all();
+    }
+    return irq;
+}
+
+void PLIC::complete(uint32_t context, uint32_t irq)
+{
+    if (irq == 0 || irq >= SOURCES_NUM)
+        return;
+
+    /* Completions for sources not enabled for the context are ignored. */
+    uint64_t bit = 1ULL << (irq % 64);
+    if ((enable[context][irq / 64] & bit) == 0)
+        return;
+
+    in_flight[irq / 64] &= ~bit;
+}
+
+uint32_t PLIC::load32(uint64_t addr)
+{
+    uint64_t off = addr - PLIC_BASE;
+
+    if (off < SOURCES_NUM * 4) {
+        return priority[off / 4];
+    }
+
+    if (addr >= PLIC_PENDING && off < 0x1000 + WORDS_NUM * 8) {
+        uint64_t bit_off = (off - 0x1000) * 8;
+        return static_cast<uint32_t>(pending[bit_off / 64] >> (bit_off % 64));
+    }
+
+    if (addr >= PLIC_ENABLE && off < 0x2000 + CONTEXTS_NUM * PLIC_ENABLE_STRIDE) {
+        uint64_t ctx = (off - 0x2000) / PLIC_ENABLE_STRIDE;
+        uint64_t bit_off = ((off - 0x2000) % PLIC_ENABLE_STRIDE) * 8;
+        if (bit_off >= SOURCES_NUM)
+            return 0;
+        return static_cast<uint32_t>(enable[ctx][bit_off / 64] >> (bit_off % 64));
+    }
+
+    if (addr >= PLIC_CONTEXT && off < 0x200000 + CONTEXTS_NUM * PLIC_CONTEXT_STRIDE) {
+        auto ctx = static_cast<uint32_t>((off - 0x200000) / PLIC_CONTEXT_STRIDE);
+        switch ((off - 0x200000) % PLIC_CONTEXT_STRIDE) {
+        case 0:
+            return threshold[ctx];
+        case 4:
+            return claim(ctx);
+        default:
+            break;
+        }
     }
 
     return 0;
 }
 
-void PLIC::store64(uint64_t addr, uint64_t data)
+void PLIC::store32(uint64_t addr, uint32_t data)
 {
-    switch (addr) {
-    case PLIC_PENDING:
-        pending = data;
-        break;
-    case PLIC_SENABLE:
-        senable = data;
-        break;
-    case PLIC_SPRIORITY:
-        spriority = data;
-        break;
-    case PLIC_SCLAIM:
-        sclaim = data;
-        break;
-    default:
-        break;
+    uint64_t off = addr - PLIC_BASE;
+
+    if (off < SOURCES_NUM * 4) {
+        /* Source 0 does not exist. */
+        if (off >= 4) {
+            priority[off / 4] = data;
+            update_all();
+        }
+        return;
+    }
+
+    if (addr >= PLIC_ENABLE && off < 0x2000 + CONTEXTS_NUM * PLIC_ENABLE_STRIDE) {
+        uint64_t ctx = (off - 0x2000) / PLIC_ENABLE_STRIDE;
+        uint64_t bit_off = ((off - 0x2000) % PLIC_ENABLE_STRIDE) * 8;
+        if (bit_off >= SOURCES_NUM)
+            return;
+        uint64_t& word = enable[ctx][bit_off / 64];
+        uint64_t mask = 0xFFFFFFFFULL << (bit_off % 64);
+        word = (word & ~mask) | (static_cast<uint64_t>(data) << (bit_off % 64));
+        /* Bit 0 stands for the non-existent source 0. */
+        enable[ctx][0] &= ~1ULL;
+        update(static_cast<uint32_t>(ctx));
+        return;
+    }
+
+    if (addr >= PLIC_CONTEXT && off < 0x200000 + CONTEXTS_NUM * PLIC_CONTEXT_STRIDE) {
+        auto ctx = static_cast<uint32_t>((off - 0x200000) / PLIC_CONTEXT_STRIDE);
+        switch ((off - 0x200000) % PLIC_CONTEXT_STRIDE) {
+        case 0:
+            threshold[ctx] = data;
+            update(ctx);
+            break;
+        case 4:
+            complete(ctx, data);
+            break;
+        default:
+            break;
+        }
     }
 }
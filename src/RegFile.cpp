@@ -11,7 +11,13 @@ void RegFile::store_reg(size_t idx, int64_t value)
 
 int64_t RegFile::load_reg(size_t idx) { return data[idx]; }
 
-std::array<int64_t, 32> RegFile::get_regs() { return data; }
+std::array<int64_t, 32> RegFile::get_regs() const { return data; }
+
+void RegFile::set_regs(const std::array<int64_t, REGS_NUM>& regs)
+{
+    data = regs;
+    data[0] = 0;
+}
 
 void RegFile::dump_regs()
 {
@@ -0,0 +1,132 @@
+#include <algorithm>
+
+#include <Scheduler.h>
+#include <util.h>
+
+Scheduler::Scheduler(const Corpus* _corpus)
+    : corpus(_corpus)
+    , tree(Corpus::MAX_ENTRIES + 1, 0)
+{
+    entries.reserve(Corpus::MAX_ENTRIES);
+}
+
+/* New entries start out with what little the corpus knows about them. */
+void Scheduler::sync()
+{
+    for (size_t idx = entries.size(); idx < corpus->size(); idx++) {
+        entries.emplace_back();
+        const Corpus::Entry& m = corpus->meta(idx);
+        uint64_t insns = m.exec_insns.load(std::memory_order_relaxed);
+        entries[idx].cost = static_cast<double>(insns);
+        if (insns > 0) {
+            sum_cost += entries[idx].cost;
+            n_cost++;
+        }
+        update_averages(idx);
+        reweigh(idx);
+    }
+}
+
+/*
+ * Seeds are only sized once mapped, and their cost is only known once they
+ * were run, so both are caught up on whenever an entry is touched.
+ */
+void Scheduler::update_averages(size_t idx)
+{
+    entry_stats& e = entries[idx];
+    if (e.execs > 0) {
+        double cost = static_cast<double>(e.insns) / static_cast<double>(e.execs);
+        if (e.cost > 0)
+            sum_cost -= e.cost;
+        else
+            n_cost++;
+        e.cost = cost;
+        sum_cost += cost;
+    }
+
+    uint64_t size = corpus->meta(idx).size.load(std::memory_order_relaxed);
+    if (e.size == 0 && size > 0) {
+        e.size = static_cast<double>(size);
+        sum_size += e.size;
+        n_size++;
+    }
+}
+
+/*
+ * Fast and small entries are favored relative to the average one, entries
+ * that were first to reach many edges are favored as rarer, and every entry
+ * loses weight as it is fuzzed without finding anything.
+ */
+double Scheduler::score(size_t idx, double& speed, double& rarity) const
+{
+    const entry_stats& e = entries[idx];
+    speed = 1.0;
+    if (e.cost > 0 && n_cost > 0)
+        speed = std::clamp(sum_cost / static_cast<double>(n_cost) / e.cost, 0.1, 10.0);
+    double small = 1.0;
+    if (e.size > 0 && n_size > 0)
+        small = std::clamp(sum_size / static_cast<double>(n_size) / e.size, 0.25, 4.0);
+
+    uint32_t new_edges = corpus->meta(idx).new_edges.load(std::memory_order_relaxed);
+    rarity = 1.0 + std::min<double>(new_edges, 15.0);
+    double yield = static_cast<double>(1 + e.finds)
+        / (1.0 + static_cast<double>(e.execs) / static_cast<double>(MAX_ENERGY));
+    return speed * small * rarity * yield;
+}
+
+void Scheduler::reweigh(size_t idx)
+{
+    double speed;
+    double rarity;
+    auto weight = static_cast<uint64_t>(score(idx, speed, rarity) * WEIGHT_SCALE);
+    weight = std::max<uint64_t>(weight, 1);
+
+    entry_stats& e = entries[idx];
+    tree_add(idx, static_cast<int64_t>(weight) - static_cast<int64_t>(e.weight));
+    total_weight = total_weight - e.weight + weight;
+    e.weight = weight;
+}
+
+size_t Scheduler::next(uint64_t& energy)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    sync();
+
+    size_t idx = tree_find(gen_rand() % total_weight);
+    double speed;
+    double rarity;
+    score(idx, speed, rarity);
+    energy = std::clamp(static_cast<uint64_t>(BASE_ENERGY * speed * rarity),
+                        BASE_ENERGY / 4, MAX_ENERGY);
+    return idx;
+}
+
+void Scheduler::complete(size_t idx, uint64_t execs, uint64_t insns, uint64_t finds)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    entry_stats& e = entries[idx];
+    e.execs += execs;
+    e.insns += insns;
+    e.finds += finds;
+    update_averages(idx);
+    reweigh(idx);
+}
+
+void Scheduler::tree_add(size_t idx, int64_t delta)
+{
+    for (size_t i = idx + 1; i < tree.size(); i += i & (~i + 1))
+        tree[i] += static_cast<uint64_t>(delta);
+}
+
+/* The entry whose cumulative weight range holds `target`, by binary lifting. */
+size_t Scheduler::tree_find(uint64_t target) const
+{
+    size_t pos = 0;
+    for (size_t step = Corpus::MAX_ENTRIES; step != 0; step >>= 1) {
+        if (pos + step < tree.size() && tree[pos + step] <= target) {
+            pos += step;
+            target -= tree[pos];
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include <StatsReporter.h>
+
+StatsReporter::StatsReporter(std::string _path, const Corpus* _corpus,
+                             SharedCoverage* _coverage, const CrashStore* _crashes)
+    : path(std::move(_path))
+    , corpus(_corpus)
+    , coverage(_coverage)
+    , crashes(_crashes)
+    , start(std::chrono::steady_clock::now())
+    , last_report(start)
+{
+}
+
+StatsReporter::totals StatsReporter::sum() const
+{
+    totals t;
+    for (const stats* st : workers) {
+        t.runs += st->runs.load(std::memory_order_relaxed);
+        t.instructions += st->instructions.load(std::memory_order_relaxed);
+        t.crashes += st->crashes.load(std::memory_order_relaxed);
+        t.timeouts += st->timeouts.load(std::memory_order_relaxed);
+        t.new_inputs += st->new_inputs.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+/* Rates on the status line cover the last interval, the file has overall ones. */
+void StatsReporter::report()
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    double interval = std::chrono::duration<double>(now - last_report).count();
+    totals t = sum();
+    uint64_t edges = coverage->edges_found();
+
+    double execs_per_sec = interval > 0 ? (double)(t.runs - last.runs) / interval : 0;
+    double mips = interval > 0
+        ? (double)(t.instructions - last.instructions) / interval / 1e6
+        : 0;
+
+    auto flags = std::cout.flags();
+    std::cout << std::fixed << std::setprecision(1) << "[" << elapsed << "s] "
+              << "execs: " << t.runs << " (" << execs_per_sec << "/s) "
+              << "MIPS: " << mips << " corpus: " << corpus->size() << " (+"
+              << t.new_inputs << ") edges: " << edges << " crashes: " << t.crashes
+              << " (" << crashes->unique_crashes() << " unique) timeouts: " << t.timeouts
+              << " (" << crashes->unique_timeouts() << " unique)" << std::endl;
+    std::cout.flags(flags);
+
+    write_file(t, edges, elapsed);
+    last = t;
+    last_report = now;
+}
+
+/* Written next to the final path and renamed, readers never see half a file. */
+void StatsReporter::write_file(const totals& t, uint64_t edges, double elapsed) const
+{
+    if (path.empty())
+        return;
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file)
+            return;
+        file << std::fixed << std::setprecision(2);
+        file << "last_update       : " << std::time(nullptr) << '\n';
+        file << "run_time          : " << elapsed << '\n';
+        file << "workers           : " << workers.size() << '\n';
+        file << "execs_done        : " << t.runs << '\n';
+        file << "execs_per_sec     : " << (elapsed > 0 ? (double)t.runs / elapsed : 0)
+             << '\n';
+        file << "instructions_done : " << t.instructions << '\n';
+        file << "guest_mips        : "
+             << (elapsed > 0 ? (double)t.instructions / elapsed / 1e6 : 0) << '\n';
+        file << "corpus_count      : " << corpus->size() << '\n';
+        file << "new_inputs        : " << t.new_inputs << '\n';
+        file << "edges_found       : " << edges << '\n';
+        file << "map_size          : " << COVERAGE_MAP_SIZE << '\n';
+        file << "crashes           : " << t.crashes << '\n';
+        file << "timeouts          : " << t.timeouts << '\n';
+        file << "unique_crashes    : " << crashes->unique_crashes() << '\n';
+        file << "unique_timeouts   : " << crashes->unique_timeouts() << '\n';
+    }
+    std::rename(tmp_path.c_str(), path.c_str());
+}
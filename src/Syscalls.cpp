@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <FileCache.h>
+#include <VEmu.h>
+
+static constexpr bool VERBOSE_OUTPUT = false;
+
+/*
+ * Guest time starts at a fixed date and advances one nanosecond per retired
+ * instruction, so a run replays the same way every time.
+ */
+static constexpr uint64_t GUEST_EPOCH = 0x6440824a;
+static constexpr uint64_t NSEC_PER_SEC = 1000000000;
+
+static constexpr int64_t GUEST_AT_FDCWD = -100;
+static constexpr uint64_t GUEST_IOV_MAX = 1024;
+static constexpr int64_t GUEST_PID = 1;
+
+const std::array<VEmu::SyscallHandler, VEmu::SYSCALL_TABLE_SIZE>& VEmu::syscall_table()
+{
+    static const auto table = [] {
+        static const std::pair<uint64_t, SyscallHandler> handlers[] = {
+            {SYSCALL_NR_IOCTL,            &VEmu::sys_ioctl        },
+            { SYSCALL_NR_OPENAT,          &VEmu::sys_openat       },
+            { SYSCALL_NR_CLOSE,           &VEmu::sys_close        },
+            { SYSCALL_NR_LSEEK,           &VEmu::sys_lseek        },
+            { SYSCALL_NR_READ,            &VEmu::sys_read         },
+            { SYSCALL_NR_WRITE,           &VEmu::sys_write        },
+            { SYSCALL_NR_READV,           &VEmu::sys_readv        },
+            { SYSCALL_NR_WRITEV,          &VEmu::sys_writev       },
+            { SYSCALL_NR_FSTAT,           &VEmu::sys_fstat        },
+            { SYSCALL_NR_EXIT,            &VEmu::sys_exit         },
+            { SYSCALL_NR_EXIT_GROUP,      &VEmu::sys_exit         },
+            { SYSCALL_NR_SET_TID_ADDRESS, &VEmu::sys_getpid       },
+            { SYSCALL_NR_CLOCK_GETTIME,   &VEmu::sys_clock_gettime},
+            { SYSCALL_NR_UNAME,           &VEmu::sys_uname        },
+            { SYSCALL_NR_GETTIMEOFDAY,    &VEmu::sys_gettimeofday },
+            { SYSCALL_NR_GETPID,          &VEmu::sys_getpid       },
+            { SYSCALL_NR_BRK,             &VEmu::sys_brk          },
+            { SYSCALL_NR_MUNMAP,          &VEmu::sys_munmap       },
+            { SYSCALL_NR_MMAP,            &VEmu::sys_mmap         },
+            { SYSCALL_NR_OPEN,            &VEmu::sys_open         },
+        };
+        std::array<SyscallHandler, SYSCALL_TABLE_SIZE> t {};
+        for (const auto& [nr, handler] : handlers)
+            t[nr] = handler;
+        return t;
+    }();
+    return table;
+}
+
+void VEmu::handle_syscall()
+{
+    uint64_t nr = iregs.load_reg(REG_A7);
+    SyscallArgs args;
+    for (uint64_t i = 0; i < args.size(); i++)
+        args[i] = iregs.load_reg(REG_A0 + i);
+
+    int64_t ret = -ENOSYS;
+    if (nr < SYSCALL_TABLE_SIZE && syscall_table()[nr] != nullptr)
+        ret = (this->*syscall_table()[nr])(args);
+    else if (VERBOSE_OUTPUT)
+        std::cout << "Unsupported syscall: " << std::dec << nr << ", pc: 0x" << std::hex
+                  << pc << std::dec << '\n';
+    if (!has_exited)
+        iregs.store_reg(REG_A0, static_cast<uint64_t>(ret));
+}
+
+int VEmu::install_file(FileHandle fh)
+{
+    int fd = alloc_fd();
+    fh.fd = fd;
+    file_table[static_cast<size_t>(fd)] = std::move(fh);
+    return fd;
+}
+
+int64_t VEmu::copy_to_guest(uint64_t addr, const void* src, uint64_t len)
+{
+    auto* bytes = static_cast<const uint8_t*>(src);
+    auto e = bus.get_mmu()->write_from(bytes, len, addr);
+    return e == ReturnException::NormalExecutionReturn ? 0 : -EFAULT;
+}
+
+/*
+ * Host files are only ever read. A writable open sees the current contents,
+ * or none at all if it truncates or creates the file, and its writes are
+ * dropped like any other file write.
+ */
+int64_t VEmu::open_file(const std::string& pathname, uint64_t flags)
+{
+    bool writable = (flags & GUEST_O_ACCMODE) != GUEST_O_RDONLY;
+    bool create = (flags & GUEST_O_CREAT) != 0;
+    bool empty = writable && (flags & GUEST_O_TRUNC) != 0;
+
+    std::shared_ptr<const char[]> data;
+    uint64_t len = 0;
+    bool exists = true;
+    auto vf = std::find_if(
+        virtual_files.begin(), virtual_files.end(),
+        [&pathname](const VirtualFile& f) { return f.pathname == pathname; });
+    if (vf != virtual_files.end()) {
+        data = vf->data;
+        len = vf->len;
+    } else if (auto file = FileCache::the().open(pathname); file != nullptr) {
+        /* The handle keeps the mapping alive. */
+        data = std::shared_ptr<const char[]>(file, file->data);
+        len = file->len;
+    } else if (errno == ENOENT && create) {
+        exists = false;
+    } else {
+        return -errno;
+    }
+
+    if (exists && create && (flags & GUEST_O_EXCL) != 0)
+        return -EEXIST;
+    if (empty || !exists)
+        return install_file({ nullptr, pathname, 0, 0, 0, FileType::DiskFile });
+    return install_file({ std::move(data), pathname, 0, len, 0, FileType::DiskFile });
+}
+
+int64_t VEmu::read_file(FileHandle& fh, uint64_t buf, uint64_t count)
+{
+    if (fh.type != FileType::DiskFile || fh.idx >= fh.len)
+        return 0;
+
+    count = std::min(count, fh.len - fh.idx);
+    if (taint != nullptr && fh.pathname == taint->source)
+        label_input(buf, count, fh.idx);
+    int64_t ret = copy_to_guest(buf, fh.data.get() + fh.idx, count);
+    if (ret < 0)
+        return ret;
+    fh.idx += count;
+    return static_cast<int64_t>(count);
+}
+
+/* Writes to files are dropped, the console goes to its sink if it has one. */
+int64_t VEmu::write_file(FileHandle& fh, uint64_t buf, uint64_t count)
+{
+    if (fh.type == FileType::Stdin)
+        return -EBADF;
+    if (!bus.get_mmu()->in_ram(buf, count))
+        return -EFAULT;
+
+    OutputSink* sink = nullptr;
+    if (fh.type == FileType::Stdout)
+        sink = stdout_sink;
+    else if (fh.type == FileType::Stderr)
+        sink = stderr_sink;
+    if (sink != nullptr) {
+        auto [data, e] = bus.get_mmu()->read_to(buf, count);
+        if (e != ReturnException::NormalExecutionReturn)
+            return -EFAULT;
+        sink->write(data.data(), data.size());
+    }
+    return static_cast<int64_t>(count);
+}
+
+/* readv and writev, one transfer per element until one falls short. */
+int64_t VEmu::transfer_vector(const SyscallArgs& args, bool write)
+{
+    FileHandle* fh = find_file(args[0]);
+    if (fh == nullptr)
+        return -EBADF;
+    if (args[2] > GUEST_IOV_MAX)
+        return -EINVAL;
+
+    int64_t total = 0;
+    for (uint64_t i = 0; i < args[2]; i++) {
+        auto [iov, e] = bus.get_mmu()->read_to(args[1] + 16 * i, 16);
+        if (e != ReturnException::NormalExecutionReturn)
+            return -EFAULT;
+        uint64_t base;
+        uint64_t len;
+        memcpy(&base, iov.data(), sizeof(base));
+        memcpy(&len, iov.data() + 8, sizeof(len));
+
+        int64_t n = write ? write_file(*fh, base, len) : read_file(*fh, base, len);
+        if (n < 0)
+            return total == 0 ? n : total;
+        total += n;
+        if (static_cast<uint64_t>(n) < len)
+            break;
+    }
+    return total;
+}
+
+int64_t VEmu::sys_ioctl(const SyscallArgs& args)
+{
+    /* Nothing is a terminal, stdio falls back to full buffering. */
+    return find_file(args[0]) == nullptr ? -EBADF : -ENOTTY;
+}
+
+int64_t VEmu::sys_openat(const SyscallArgs& args)
+{
+    auto pathname = bus.get_mmu()->_read_null_terminated_string(args[1]);
+    /* Directory descriptors are not modelled, relative paths use the host cwd. */
+    if (static_cast<int64_t>(args[0]) != GUEST_AT_FDCWD && pathname.rfind('/', 0) != 0
+        && find_file(args[0]) == nullptr)
+        return -EBADF;
+    return open_file(pathname, args[2]);
+}
+
+int64_t VEmu::sys_open(const SyscallArgs& args)
+{
+    return open_file(bus.get_mmu()->_read_null_terminated_string(args[0]), args[1]);
+}
+
+int64_t VEmu::sys_close(const SyscallArgs& args)
+{
+    FileHandle* fh = find_file(args[0]);
+    if (fh == nullptr)
+        return -EBADF;
+    *fh = FileHandle { nullptr, "", fh->fd, 0, 0, FileType::Closed };
+    return 0;
+}
+
+int64_t VEmu::sys_lseek(const SyscallArgs& args)
+{
+    FileHandle* fh = find_file(args[0]);
+    if (fh == nullptr)
+        return -EBADF;
+
+    auto offset = static_cast<int64_t>(args[1]);
+    int64_t base;
+    if (args[2] == SEEK_SET)
+        base = 0;
+    else if (args[2] == SEEK_CUR)
+        base = static_cast<int64_t>(fh->idx);
+    else if (args[2] == SEEK_END)
+        base = static_cast<int64_t>(fh->len);
+    else
+        return -EINVAL;
+    if (base + offset < 0)
+        return -EINVAL;
+
+    fh->idx = static_cast<uint64_t>(base + offset);
+    return base + offset;
+}
+
+int64_t VEmu::sys_read(const SyscallArgs& args)
+{
+    FileHandle* fh = find_file(args[0]);
+    return fh == nullptr ? -EBADF : read_file(*fh, args[1], args[2]);
+}
+
+int64_t VEmu::sys_write(const SyscallArgs& args)
+{
+    FileHandle* fh = find_file(args[0]);
+    return fh == nullptr ? -EBADF : write_file(*fh, args[1], args[2]);
+}
+
+int64_t VEmu::sys_readv(const SyscallArgs& args) { return transfer_vector(args, false); }
+
+int64_t VEmu::sys_writev(const SyscallArgs& args) { return transfer_vector(args, true); }
+
+int64_t VEmu::sys_fstat(const SyscallArgs& args)
+{
+    FileHandle* fh = find_file(args[0]);
+    if (fh == nullptr)
+        return -EBADF;
+
+    struct riscv_stat {
+        uint64_t _st_dev;
+        uint64_t _st_ino;
+        uint32_t _st_mode;
+        uint32_t _st_nlink;
+        uint32_t _st_uid;
+        uint32_t _st_gid;
+        uint64_t _st_rdev;
+        uint64_t _ppad1;
+        int64_t _st_size;
+        int32_t _st_blksize;
+        int32_t _ppad2;
+        uint64_t _st_blocks;
+        uint64_t _st_atime;
+        uint64_t _st_atimensec;
+        uint64_t _st_mtime;
+        uint64_t _st_mtimensec;
+        uint64_t _st_ctime;
+        uint64_t _st_ctimensec;
+        int __glibc_reserved[2];
+    } st {};
+
+    /* The console is a character device, everything else a regular file. */
+    bool console = fh->type != FileType::DiskFile;
+    st._st_dev = console ? 0x18 : 0x802;
+    st._st_ino = console ? 0x3 : 0x22068c;
+    st._st_mode = console ? 0x2190 : 0x81fd;
+    st._st_nlink = 0x1;
+    st._st_uid = 0x3e8;
+    st._st_gid = console ? 0x5 : 0x3e8;
+    st._st_rdev = console ? 0x8800 : 0x0;
+    st._st_size = console ? 0x0 : static_cast<int64_t>(fh->len);
+    st._st_blksize = console ? 0x400 : 0x1000;
+    st._st_blocks = console ? 0x0 : fh->len / static_cast<uint64_t>(st._st_blksize);
+    st._st_atime = 0x6440824f;
+    st._st_mtime = 0x6440824a;
+    st._st_ctime = 0x6440824a;
+    return copy_to_guest(args[1], &st, sizeof(st));
+}
+
+int64_t VEmu::sys_exit(const SyscallArgs& args)
+{
+    exit_emu(static_cast<uint8_t>(static_cast<int>(args[0]) % 255));
+    return 0;
+}
+
+int64_t VEmu::sys_clock_gettime(const SyscallArgs& args)
+{
+    const uint64_t ts[2] = { GUEST_EPOCH + retired / NSEC_PER_SEC,
+                             retired % NSEC_PER_SEC };
+    return copy_to_guest(args[1], ts, sizeof(ts));
+}
+
+int64_t VEmu::sys_gettimeofday(const SyscallArgs& args)
+{
+    const uint64_t tv[2] = { GUEST_EPOCH + retired / NSEC_PER_SEC,
+                             retired % NSEC_PER_SEC / 1000 };
+    return args[0] == 0 ? 0 : copy_to_guest(args[0], tv, sizeof(tv));
+}
+
+int64_t VEmu::sys_uname(const SyscallArgs& args)
+{
+    constexpr size_t FIELD_LEN = 65;
+    const char* fields[] = { "Linux", "vemu", "6.1.0", "#1", "riscv64", "" };
+    char uts[std::size(fields) * FIELD_LEN] {};
+    for (size_t i = 0; i < std::size(fields); i++)
+        strncpy(uts + i * FIELD_LEN, fields[i], FIELD_LEN - 1);
+    return copy_to_guest(args[0], uts, sizeof(uts));
+}
+
+int64_t VEmu::sys_getpid(const SyscallArgs&) { return GUEST_PID; }
+
+int64_t VEmu::sys_brk(const SyscallArgs& args)
+{
+    /* A break that cannot move stays where it is, the guest sees that as failure. */
+    if (args[0] != 0)
+        bus.get_mmu()->set_break(args[0]);
+    return static_cast<int64_t>(bus.get_mmu()->cur_alloc_ptr());
+}
+
+int64_t VEmu::sys_mmap(const SyscallArgs& args)
+{
+    if (args[1] == 0)
+        return -EINVAL;
+    if ((args[3] & MAP_ANONYMOUS) == 0)
+        return -ENODEV;
+
+    BytePermission perms = 0;
+    if ((args[2] & PROT_READ) != 0)
+        perms |= PERM_READ;
+    if ((args[2] & PROT_WRITE) != 0)
+        perms |= PERM_WRITE;
+    if ((args[2] & PROT_EXEC) != 0)
+        perms |= PERM_EXEC;
+    uint64_t base
+        = bus.get_mmu()->map_pages(args[0], args[1], perms, (args[3] & MAP_FIXED) != 0);
+    return base == 0 ? -ENOMEM : static_cast<int64_t>(base);
+}
+
+int64_t VEmu::sys_munmap(const SyscallArgs& args)
+{
+    if (args[0] % GUEST_PAGE_SIZE != 0 || args[1] == 0)
+        return -EINVAL;
+    bus.get_mmu()->unmap_pages(args[0], args[1]);
+    return 0;
+}
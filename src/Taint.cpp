@@ -0,0 +1,36 @@
+#include <Taint.h>
+
+void TaintTracker::clear()
+{
+    regs.fill({});
+    branches.clear();
+}
+
+void TaintTracker::record_branch(const TaintRange& r)
+{
+    if (!r.empty() && branches.size() < MAX_BRANCHES)
+        branches.insert(static_cast<uint64_t>(r.lo) << 32 | r.hi);
+}
+
+std::vector<uint32_t> TaintTracker::hot_offsets(uint64_t input_len) const
+{
+    /* Marks every range in a difference array, then sweeps it once. */
+    std::vector<int32_t> delta(input_len + 1);
+    for (auto key : branches) {
+        auto lo = static_cast<uint32_t>(key >> 32);
+        uint64_t hi = std::min<uint64_t>(static_cast<uint32_t>(key), input_len);
+        if (lo >= hi)
+            continue;
+        delta[lo]++;
+        delta[hi]--;
+    }
+
+    std::vector<uint32_t> hot;
+    int32_t depth = 0;
+    for (uint64_t i = 0; i < input_len; i++) {
+        depth += delta[i];
+        if (depth > 0)
+            hot.push_back(static_cast<uint32_t>(i));
+    }
+    return hot;
+}
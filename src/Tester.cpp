@@ -17,6 +17,14 @@ void Tester::run()
         VEmu em = VEmu { info, std::vector<char*> {}, 2 * 1024 * 1024 };
         em.run();
     }
+
+    for (const auto& test : unit_tests) {
+        std::cout << "Starting test: " << test.name << "... ";
+        if (test.run())
+            std::cout << "Passed\n";
+        else
+            std::cout << "Failed test: " << test.name << '\n';
+    }
 }
 
 const std::vector<TestCase> Tester::test_cases
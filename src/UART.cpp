@@ -14,8 +14,8 @@ UART::UART()
     std::thread read_thread([this]() {
         unsigned char c;
 
-        while (true) {
-            std::cin >> std::noskipws >> c;
+        /* Stop at the end of input rather than delivering stale bytes forever. */
+        while (std::cin >> std::noskipws >> c) {
 
             /* TODO: Use a condvar instead of spinning. */
             while ((uart_mem[UART_LSR - UART_BASE] & UART_LSR_RX) == 1)
@@ -23,6 +23,7 @@ UART::UART()
 
             uart_mem[UART_RHR - UART_BASE] = c;
             uart_mem[UART_LSR - UART_BASE] |= UART_LSR_RX;
+            raise_irq();
         }
     });
 
@@ -63,6 +64,17 @@ ReturnException UART::store(uint64_t addr, uint64_t value, size_t sz)
     return res;
 }
 
+void UART::save(SnapshotWriter& w) const
+{
+    w.put(uart_mem);
+}
+
+void UART::restore(SnapshotReader& r)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    uart_mem = r.get<decltype(uart_mem)>();
+}
+
 uint64_t UART::load8(uint64_t addr)
 {
     std::lock_guard<std::mutex> lock(mu);
@@ -0,0 +1,678 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include <Coverage.h>
+#include <CrashStore.h>
+#include <IoRing.h>
+#include <Minimizer.h>
+#include <Mutator.h>
+#include <OutputSink.h>
+#include <PLIC.h>
+#include <Scheduler.h>
+#include <Tester.h>
+#include <VirtioConsole.h>
+#include <util.h>
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            std::cout << "check failed at " << __FILE__ << ':' << __LINE__ << ": "     \
+                      << #cond << '\n';                                                \
+            return false;                                                              \
+        }                                                                              \
+    } while (0)
+
+static constexpr uint64_t TEST_RAM_SIZE = 2 * 1024 * 1024;
+
+const std::vector<UnitTest> Tester::unit_tests = {
+    { "plic-arbitration",    &Tester::plic_arbitration    },
+    { "plic-claim-complete", &Tester::plic_claim_complete },
+    { "snapshot-round-trip", &Tester::snapshot_round_trip },
+    { "syscall-table",       &Tester::syscall_table       },
+    { "file-syscalls",       &Tester::file_syscalls       },
+    { "page-allocator",      &Tester::page_allocator      },
+    { "heap-break",          &Tester::heap_break          },
+    { "coverage-never-zero", &Tester::coverage_never_zero },
+    { "mutator-ops",         &Tester::mutator_ops         },
+    { "scheduler",           &Tester::scheduler           },
+    { "crash-buckets",       &Tester::crash_buckets       },
+    { "output-capture",      &Tester::output_capture      },
+    { "minimizer-trim",      &Tester::minimizer_trim      },
+    { "virtio-dma-bounds",   &Tester::virtio_dma_bounds   },
+};
+
+static uint64_t claim(PLIC& plic, uint64_t claim_addr)
+{
+    return plic.load(claim_addr, 32).first;
+}
+
+bool Tester::plic_arbitration()
+{
+    PLIC plic;
+    plic.store(PLIC_PRIORITY + 3 * 4, 2, 32);
+    plic.store(PLIC_PRIORITY + 5 * 4, 5, 32);
+    plic.store(PLIC_PRIORITY + 7 * 4, 5, 32);
+    plic.store(PLIC_SENABLE, (1 << 3) | (1 << 5) | (1 << 7), 32);
+    plic.raise(3);
+    plic.raise(7);
+    plic.raise(5);
+
+    CHECK(plic.is_pending(PLIC_CONTEXT_S));
+    CHECK(!plic.is_pending(PLIC_CONTEXT_M));
+    CHECK(((plic.load(PLIC_PENDING, 32).first >> 3) & 1) == 1);
+
+    /* Highest priority first, ties go to the lowest source. */
+    CHECK(claim(plic, PLIC_SCLAIM) == 5);
+    CHECK(claim(plic, PLIC_SCLAIM) == 7);
+    CHECK(claim(plic, PLIC_SCLAIM) == 3);
+    CHECK(claim(plic, PLIC_SCLAIM) == 0);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+    for (uint32_t irq : { 3, 5, 7 })
+        plic.store(PLIC_SCLAIM, irq, 32);
+
+    /* Only priorities above the threshold interrupt. */
+    plic.store(PLIC_STHRESHOLD, 2, 32);
+    plic.raise(3);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+    CHECK(claim(plic, PLIC_SCLAIM) == 0);
+    plic.store(PLIC_STHRESHOLD, 1, 32);
+    CHECK(plic.is_pending(PLIC_CONTEXT_S));
+
+    /* Priority 0 never interrupts. */
+    plic.store(PLIC_PRIORITY + 3 * 4, 0, 32);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+    return true;
+}
+
+bool Tester::plic_claim_complete()
+{
+    PLIC plic;
+    plic.store(PLIC_PRIORITY + 9 * 4, 1, 32);
+    plic.store(PLIC_SENABLE, 1 << 9, 32);
+    plic.raise(9);
+    CHECK(claim(plic, PLIC_SCLAIM) == 9);
+
+    /* The gateway drops requests while the claimed one is in flight. */
+    plic.raise(9);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+
+    /* Completing through a context the source is not enabled for does nothing. */
+    plic.store(PLIC_CONTEXT + 4, 9, 32);
+    plic.raise(9);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+
+    plic.store(PLIC_SCLAIM, 9, 32);
+    plic.raise(9);
+    CHECK(plic.is_pending(PLIC_CONTEXT_S));
+
+    /* A source enabled for both contexts goes to whichever claims it first. */
+    plic.store(PLIC_ENABLE, 1 << 9, 32);
+    CHECK(plic.is_pending(PLIC_CONTEXT_M));
+    CHECK(claim(plic, PLIC_CONTEXT + 4) == 9);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+    CHECK(claim(plic, PLIC_SCLAIM) == 0);
+
+    /* Source 0 and sources past the last do not exist. */
+    plic.store(PLIC_CONTEXT + 4, 9, 32);
+    plic.store(PLIC_SENABLE, 1, 32);
+    CHECK(plic.load(PLIC_SENABLE, 32).first == 0);
+    plic.raise(0);
+    plic.raise(PLIC::SOURCES_NUM);
+    CHECK(!plic.is_pending(PLIC_CONTEXT_S));
+    return true;
+}
+
+bool Tester::snapshot_round_trip()
+{
+    FileInfo* info = read_elf("../tests/elf/rv64ui-p-add", false);
+    CHECK(info->entry_point != ~0ULL);
+    VEmu em { info, std::vector<char*> {}, TEST_RAM_SIZE };
+    em.set_instruction_limit(60);
+    em.run();
+
+    auto path = (std::filesystem::temp_directory_path() / "vemu-test.snap").string();
+    CHECK(em.save_snapshot(path));
+    auto cut = path + ".cut";
+    std::filesystem::copy_file(path, cut,
+                               std::filesystem::copy_options::overwrite_existing);
+    auto iregs = em.get_iregs();
+    auto csrs = em.csrs;
+    uint64_t pc = em.pc;
+    std::vector<uint8_t> ram(TEST_RAM_SIZE);
+    CHECK(em.bus.get_mmu()->dma_read(0, ram.data(), ram.size()));
+
+    /* Scribble over the machine, then bring it back. */
+    em.set_instruction_limit(em.instructions_retired() + 20);
+    em.run();
+    em.set_ireg(REG_A0, 0xdead);
+    const uint8_t junk[] = { 0xde, 0xad, 0xbe, 0xef };
+    em.patch_memory(pc, junk, sizeof(junk));
+    CHECK(em.restore_snapshot(path));
+
+    VEmu fresh { info, std::vector<char*> {}, TEST_RAM_SIZE };
+    CHECK(fresh.restore_snapshot(path));
+    std::filesystem::remove(path);
+
+    std::vector<uint8_t> restored(TEST_RAM_SIZE);
+    for (VEmu* m : { &em, &fresh }) {
+        CHECK(m->get_iregs() == iregs);
+        CHECK(m->csrs == csrs);
+        CHECK(m->pc == pc);
+        CHECK(m->bus.get_mmu()->dma_read(0, restored.data(), restored.size()));
+        CHECK(restored == ram);
+    }
+
+    /* A truncated snapshot is refused and leaves the machine alone. */
+    std::filesystem::resize_file(cut, TEST_RAM_SIZE);
+    CHECK(!em.restore_snapshot(cut));
+    CHECK(em.get_iregs() == iregs);
+    CHECK(em.pc == pc);
+
+    /* So is one whose state runs out halfway, after the registers were read. */
+    std::filesystem::resize_file(cut, 2 * SNAPSHOT_SECTION_ALIGN + 2 * TEST_RAM_SIZE);
+    {
+        std::fstream f(cut, std::ios::in | std::ios::out | std::ios::binary);
+        uint64_t state_size = 300;
+        f.seekp(offsetof(SnapshotHeader, state_size));
+        f.write(reinterpret_cast<const char*>(&state_size), sizeof(state_size));
+    }
+    em.set_ireg(REG_A0, 0xdead);
+    CHECK(!em.restore_snapshot(cut));
+    std::filesystem::remove(cut);
+    CHECK(em.get_iregs()[REG_A0] == 0xdead);
+    em.set_ireg(REG_A0, static_cast<uint64_t>(iregs[REG_A0]));
+
+    /* Both carry on from the snapshot the same way. */
+    em.set_instruction_limit(em.instructions_retired() + 20);
+    em.run();
+    fresh.set_instruction_limit(fresh.instructions_retired() + 20);
+    fresh.run();
+    CHECK(em.get_iregs() == fresh.get_iregs());
+    CHECK(em.pc == fresh.pc);
+    return true;
+}
+
+static int64_t do_syscall(VEmu& em, uint64_t nr, std::initializer_list<uint64_t> args)
+{
+    em.set_ireg(REG_A7, nr);
+    uint64_t reg = REG_A0;
+    for (uint64_t arg : args)
+        em.set_ireg(reg++, arg);
+    em.handle_syscall();
+    return em.get_iregs()[REG_A0];
+}
+
+/* Copies `s` into a fresh guest buffer and returns its address. */
+static uint64_t guest_string(VEmu& em, const std::string& s)
+{
+    uint64_t addr = em.allocate_buffer(s.size() + 1);
+    em.patch_memory(addr, reinterpret_cast<const uint8_t*>(s.c_str()), s.size() + 1);
+    return addr;
+}
+
+bool Tester::syscall_table()
+{
+    VEmu em { std::vector<uint8_t>(16), 0, TEST_RAM_SIZE };
+    CHECK(do_syscall(em, 999, {}) == -ENOSYS);
+    CHECK(do_syscall(em, VEmu::SYSCALL_TABLE_SIZE + 1, {}) == -ENOSYS);
+    CHECK(do_syscall(em, SYSCALL_NR_GETPID, {}) == 1);
+    CHECK(do_syscall(em, SYSCALL_NR_IOCTL, { 1, 0x5401 }) == -ENOTTY);
+    CHECK(do_syscall(em, SYSCALL_NR_IOCTL, { 42, 0x5401 }) == -EBADF);
+
+    uint64_t buf = em.allocate_buffer(6 * 65);
+    CHECK(do_syscall(em, SYSCALL_NR_UNAME, { buf }) == 0);
+    char sysname[6] {};
+    CHECK(em.bus.get_mmu()->dma_read(buf, reinterpret_cast<uint8_t*>(sysname), 5));
+    CHECK(strcmp(sysname, "Linux") == 0);
+    CHECK(do_syscall(em, SYSCALL_NR_UNAME, { 0 }) == -EFAULT);
+
+    /* Console writes reach the sink, stdin cannot be written. */
+    OutputSink out = OutputSink::capture(64);
+    em.set_output(&out, &out);
+    uint64_t msg = guest_string(em, "hi");
+    CHECK(do_syscall(em, SYSCALL_NR_WRITE, { 1, msg, 2 }) == 2);
+    CHECK(do_syscall(em, SYSCALL_NR_WRITE, { 0, msg, 2 }) == -EBADF);
+    CHECK(out.captured() == "hi");
+
+    CHECK(do_syscall(em, SYSCALL_NR_EXIT_GROUP, { 3 }) == 3);
+    CHECK(em.get_exit_code() == 3);
+    return true;
+}
+
+bool Tester::file_syscalls()
+{
+    VEmu em { std::vector<uint8_t>(16), 0, TEST_RAM_SIZE };
+    const std::string contents = "hello world";
+    std::shared_ptr<char[]> data(new char[contents.size()]);
+    memcpy(data.get(), contents.data(), contents.size());
+    em.set_virtual_file("/input", data, contents.size());
+
+    const auto at_fdcwd = static_cast<uint64_t>(-100);
+    uint64_t input = guest_string(em, "/input");
+    uint64_t buf = em.allocate_buffer(256);
+    auto read_back = [&em, buf](uint64_t len) {
+        std::string s(len, '\0');
+        if (!em.bus.get_mmu()->dma_read(buf, reinterpret_cast<uint8_t*>(s.data()), len))
+            return std::string();
+        return s;
+    };
+
+    int64_t fd = do_syscall(em, SYSCALL_NR_OPENAT, { at_fdcwd, input, 0 });
+    CHECK(fd == 3);
+    auto ufd = static_cast<uint64_t>(fd);
+    CHECK(do_syscall(em, SYSCALL_NR_READ, { ufd, buf, 5 }) == 5);
+    CHECK(read_back(5) == "hello");
+    const auto back = static_cast<uint64_t>(-5);
+    CHECK(do_syscall(em, SYSCALL_NR_LSEEK, { ufd, back, SEEK_END }) == 6);
+    CHECK(do_syscall(em, SYSCALL_NR_READ, { ufd, buf, 100 }) == 5);
+    CHECK(read_back(5) == "world");
+    CHECK(do_syscall(em, SYSCALL_NR_READ, { ufd, buf, 100 }) == 0);
+    CHECK(do_syscall(em, SYSCALL_NR_FSTAT, { ufd, buf }) == 0);
+    int64_t size = 0;
+    CHECK(em.bus.get_mmu()->dma_read(buf + 48, reinterpret_cast<uint8_t*>(&size), 8));
+    CHECK(size == static_cast<int64_t>(contents.size()));
+
+    /* Closed descriptors are reused lowest first. */
+    CHECK(do_syscall(em, SYSCALL_NR_CLOSE, { ufd }) == 0);
+    CHECK(do_syscall(em, SYSCALL_NR_READ, { ufd, buf, 1 }) == -EBADF);
+    CHECK(do_syscall(em, SYSCALL_NR_CLOSE, { ufd }) == -EBADF);
+    CHECK(do_syscall(em, SYSCALL_NR_OPEN, { input, 0 }) == 3);
+
+    /* Writable opens never touch the host file. */
+    auto host = std::filesystem::temp_directory_path() / "vemu-test-file";
+    std::ofstream(host) << "keep";
+    uint64_t host_path = guest_string(em, host.string());
+    uint64_t trunc = GUEST_O_WRONLY | GUEST_O_CREAT | GUEST_O_TRUNC;
+    fd = do_syscall(em, SYSCALL_NR_OPEN, { host_path, trunc });
+    CHECK(fd == 4);
+    CHECK(do_syscall(em, SYSCALL_NR_FSTAT, { static_cast<uint64_t>(fd), buf }) == 0);
+    CHECK(em.bus.get_mmu()->dma_read(buf + 48, reinterpret_cast<uint8_t*>(&size), 8));
+    CHECK(size == 0);
+    uint64_t excl = GUEST_O_WRONLY | GUEST_O_CREAT | GUEST_O_EXCL;
+    CHECK(do_syscall(em, SYSCALL_NR_OPEN, { host_path, excl }) == -EEXIST);
+    std::ifstream kept(host);
+    CHECK(std::string(std::istreambuf_iterator<char>(kept), {}) == "keep");
+    std::filesystem::remove(host);
+
+    CHECK(do_syscall(em, SYSCALL_NR_OPEN, { host_path, 0 }) == -ENOENT);
+    CHECK(do_syscall(em, SYSCALL_NR_OPEN, { host_path, excl }) == 5);
+    CHECK(!std::filesystem::exists(host));
+
+    /* Lengths past the end of guest memory fault before anything is copied. */
+    OutputSink out = OutputSink::capture(64);
+    em.set_output(&out, &out);
+    const uint64_t huge = 1ULL << 40;
+    CHECK(do_syscall(em, SYSCALL_NR_WRITE, { 1, buf, huge }) == -EFAULT);
+    const uint64_t iov[] = { buf, huge };
+    em.patch_memory(buf, reinterpret_cast<const uint8_t*>(iov), sizeof(iov));
+    CHECK(do_syscall(em, SYSCALL_NR_WRITEV, { 1, buf, 1 }) == -EFAULT);
+    CHECK(out.captured().empty());
+    return true;
+}
+
+static bool loads(MMU& mmu, uint64_t addr)
+{
+    return mmu.load(addr, 64).second == ReturnException::NormalExecutionReturn;
+}
+
+static bool stores(MMU& mmu, uint64_t addr, uint64_t value)
+{
+    return mmu.store(addr, value, 64) == ReturnException::NormalExecutionReturn;
+}
+
+bool Tester::page_allocator()
+{
+    MMU mmu { TEST_RAM_SIZE };
+    const BytePermission rw = PERM_READ | PERM_WRITE;
+
+    /* Mappings are handed out top-down, below the last page. */
+    uint64_t base = mmu.map_pages(0, 3 * GUEST_PAGE_SIZE, rw, false);
+    CHECK(base == TEST_RAM_SIZE - 4 * GUEST_PAGE_SIZE);
+    CHECK(stores(mmu, base + 8, 0x1234));
+    CHECK(mmu.load(base + 8, 64).first == 0x1234);
+    CHECK(mmu.load(base + 2 * GUEST_PAGE_SIZE, 64).first == 0);
+
+    uint64_t ro = mmu.map_pages(0, 1, PERM_READ, false);
+    CHECK(ro == base - GUEST_PAGE_SIZE);
+    CHECK(loads(mmu, ro));
+    CHECK(!stores(mmu, ro, 1));
+
+    /* Unmapped pages fault, a fixed mapping over them starts zeroed again. */
+    mmu.unmap_pages(base, 3 * GUEST_PAGE_SIZE);
+    CHECK(!loads(mmu, base + 8));
+    CHECK(mmu.map_pages(base, GUEST_PAGE_SIZE, rw, true) == base);
+    CHECK(mmu.load(base + 8, 64).first == 0);
+
+    /* Fixed mappings must be aligned and stay above the heap. */
+    CHECK(mmu.map_pages(base + 1, GUEST_PAGE_SIZE, rw, true) == 0);
+    CHECK(mmu.map_pages(GUEST_PAGE_SIZE, GUEST_PAGE_SIZE, rw, true) == 0);
+    CHECK(mmu.map_pages(0, TEST_RAM_SIZE, rw, false) == 0);
+    CHECK(mmu.map_pages(0, 0, rw, false) == 0);
+
+    /* A reset drops the mappings made since the copy. */
+    MMU golden { TEST_RAM_SIZE };
+    MMU copy { golden };
+    uint64_t m = copy.map_pages(0, GUEST_PAGE_SIZE, rw, false);
+    CHECK(stores(copy, m, 7));
+    copy.reset_to(golden);
+    CHECK(!loads(copy, m));
+    CHECK(copy.map_pages(0, GUEST_PAGE_SIZE, rw, false) == m);
+    CHECK(copy.load(m, 64).first == 0);
+    return true;
+}
+
+bool Tester::heap_break()
+{
+    MMU mmu { TEST_RAM_SIZE };
+    uint64_t start = mmu.allocate(0x100);
+    uint64_t brk = mmu.cur_alloc_ptr();
+    CHECK(start < brk);
+
+    CHECK(mmu.set_break(brk + 2 * GUEST_PAGE_SIZE));
+    CHECK(stores(mmu, brk + GUEST_PAGE_SIZE, 1));
+    CHECK(loads(mmu, brk + GUEST_PAGE_SIZE));
+
+    /* Shrinking takes the pages away, but never below what the host allocated. */
+    CHECK(mmu.set_break(brk));
+    CHECK(!stores(mmu, brk + GUEST_PAGE_SIZE, 1));
+    CHECK(!mmu.set_break(start));
+    CHECK(mmu.cur_alloc_ptr() == brk);
+
+    /* The heap cannot grow into a mapping. */
+    uint64_t m = mmu.map_pages(0, GUEST_PAGE_SIZE, PERM_READ, false);
+    CHECK(!mmu.set_break(m + 8));
+    CHECK(mmu.set_break(m));
+    return true;
+}
+
+bool Tester::coverage_never_zero()
+{
+    CoverageMap cov;
+    auto count = [&cov]() {
+        const uint8_t* map = cov.data();
+        return *std::max_element(map, map + COVERAGE_MAP_SIZE);
+    };
+
+    for (int i = 0; i < 255; i++)
+        cov.hit_edge(0x1000, 0x2000);
+    CHECK(count() == 255);
+    /* The 256th hit wraps past zero instead of onto it. */
+    cov.hit_edge(0x1000, 0x2000);
+    CHECK(count() == 1);
+    return true;
+}
+
+bool Tester::mutator_ops()
+{
+    using Op = Mutator::Op;
+    seed_rand(1);
+    Mutator m;
+    const std::string input(64, 'A');
+    auto mutated = [&m]() { return std::string(m.data(), m.size()); };
+
+    /* No op outgrows the buffer, and an empty input can only grow. */
+    for (int op = 0; op < static_cast<int>(Op::OpsNum); op++) {
+        for (int i = 0; i < 100; i++) {
+            bool empty = i % 2 != 0;
+            m.load(input.data(), empty ? 0 : input.size());
+            m.apply(static_cast<Op>(op));
+            CHECK(m.size() <= Mutator::MAX_INPUT_SIZE);
+            if (empty)
+                CHECK(m.size() > 0 || static_cast<Op>(op) == Op::InsertToken);
+        }
+    }
+
+    /* Byte flips, random bytes and arithmetic always change something. */
+    for (Op op : { Op::FlipBit, Op::RandomByte, Op::Arith8 }) {
+        for (int i = 0; i < 100; i++) {
+            m.load(input.data(), input.size());
+            m.apply(op);
+            CHECK(mutated() != input);
+        }
+    }
+
+    std::vector<char> big(Mutator::MAX_INPUT_SIZE + 16, 'A');
+    m.load(big.data(), big.size());
+    CHECK(m.size() == Mutator::MAX_INPUT_SIZE);
+
+    const std::string tail(32, 'B');
+    m.load(input.data(), input.size());
+    m.splice(tail.data(), tail.size());
+    CHECK(m.size() == tail.size());
+    CHECK(m.data()[0] == 'A' && m.data()[tail.size() - 1] == 'B');
+
+    m.add_token("MAGIC");
+    m.load(input.data(), input.size());
+    m.apply(Op::InsertToken);
+    CHECK(m.size() == input.size() + 5 && mutated().find("MAGIC") != std::string::npos);
+    m.load(input.data(), input.size());
+    m.apply(Op::OverwriteToken);
+    CHECK(m.size() == input.size() && mutated().find("MAGIC") != std::string::npos);
+
+    /* A logged operand found in the input gets replaced by the other one. */
+    CmpLog log;
+    log.record(0x1000, 0x41424344, 0x61626364);
+    m.set_cmplog(&log);
+    const std::string cmp = "xxxxDCBAxxxx";
+    int replaced = 0;
+    for (int i = 0; i < 64; i++) {
+        m.load(cmp.data(), cmp.size());
+        m.apply(Op::ReplaceOperand);
+        CHECK(m.size() == cmp.size());
+        replaced += mutated() == "xxxxdcbaxxxx";
+    }
+    CHECK(replaced > 0);
+    return true;
+}
+
+bool Tester::scheduler()
+{
+    seed_rand(1);
+    auto dir = std::filesystem::temp_directory_path() / "vemu-test-corpus";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    std::ofstream(dir / "seed") << "seed";
+
+    Corpus corpus(dir.string());
+    corpus.promote("rare", 1000, 15);
+    corpus.promote("hits", 1000, 0);
+    Scheduler sched(&corpus);
+
+    /* Picks follow the weights: reaching new edges first makes an entry rarer. */
+    auto pick = [&sched](std::array<uint64_t, 3>& picks) {
+        picks.fill(0);
+        for (int i = 0; i < 4096; i++) {
+            uint64_t energy = 0;
+            size_t idx = sched.next(energy);
+            if (idx >= picks.size() || energy < Scheduler::BASE_ENERGY / 4
+                || energy > Scheduler::MAX_ENERGY)
+                return false;
+            picks[idx]++;
+        }
+        return true;
+    };
+    std::array<uint64_t, 3> picks {};
+    CHECK(pick(picks));
+    CHECK(picks[1] > 4 * picks[2]);
+
+    /* An entry fuzzed at length without a single find falls behind. */
+    uint64_t execs = 1023 * Scheduler::MAX_ENERGY;
+    sched.complete(1, execs, 1000 * execs, 0);
+    CHECK(pick(picks));
+    CHECK(picks[2] > 4 * picks[1]);
+
+    std::filesystem::remove_all(dir);
+    return true;
+}
+
+bool Tester::crash_buckets()
+{
+    using Kind = CrashStore::Kind;
+    auto report = [](Kind kind, uint64_t pc, uint64_t stack_hash) {
+        return CrashStore::Report { kind, { pc, stack_hash },
+                                    ReturnException::NormalExecutionReturn, 0, "" };
+    };
+
+    /* Crashes are told apart by pc and stack, timeouts by the stack alone. */
+    auto bucket = [&report](Kind kind, uint64_t pc, uint64_t stack_hash) {
+        return CrashStore::bucket(report(kind, pc, stack_hash));
+    };
+    CHECK(bucket(Kind::Crash, 0x1000, 1) != bucket(Kind::Crash, 0x1004, 1));
+    CHECK(bucket(Kind::Crash, 0x1000, 1) != bucket(Kind::Crash, 0x1000, 2));
+    CHECK(bucket(Kind::Timeout, 0x1000, 1) == bucket(Kind::Timeout, 0x1004, 1));
+    CHECK(bucket(Kind::Timeout, 0x1000, 1) != bucket(Kind::Timeout, 0x1000, 2));
+    CHECK(bucket(Kind::Crash, 0x1000, 1) != bucket(Kind::Timeout, 0x1000, 1));
+
+    FileInfo* info = read_elf("../tests/elf/rv64ui-p-add", false);
+    CHECK(info->entry_point != ~0ULL);
+    VEmu golden { info, std::vector<char*> {}, TEST_RAM_SIZE };
+    auto dir = std::filesystem::temp_directory_path() / "vemu-test-crashes";
+    std::filesystem::remove_all(dir);
+    CrashStore store(dir.string());
+
+    /* Repeats of a bucket are dropped, and so are timeouts past the cap. */
+    CHECK(store.add(report(Kind::Crash, 0x1000, 1), "a", golden));
+    CHECK(!store.add(report(Kind::Crash, 0x1000, 1), "b", golden));
+    CHECK(std::filesystem::exists(dir / "crash-1000-1" / "input"));
+    for (uint64_t i = 0; i < CrashStore::MAX_TIMEOUTS + 8; i++)
+        store.add(report(Kind::Timeout, 0x1000, i), "t", golden);
+    CHECK(store.unique_crashes() == 1);
+    CHECK(store.unique_timeouts() == CrashStore::MAX_TIMEOUTS);
+
+    std::filesystem::remove_all(dir);
+    return true;
+}
+
+bool Tester::output_capture()
+{
+    OutputSink sink = OutputSink::capture(8);
+    auto write = [&sink](const std::string& s) {
+        sink.write(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+        return sink.captured();
+    };
+
+    /* The ring keeps the last 8 bytes, oldest first, across the wrap. */
+    CHECK(write("abc") == "abc");
+    CHECK(write("defgh") == "abcdefgh");
+    CHECK(write("ij") == "cdefghij");
+    CHECK(write("klmnopq") == "jklmnopq");
+    CHECK(write("0123456789AB") == "456789AB");
+    sink.clear();
+    CHECK(sink.captured().empty());
+    CHECK(write("xy") == "xy");
+
+    /* Host output is batched and arrives once flushed and drained. */
+    auto path = std::filesystem::temp_directory_path() / "vemu-test-output";
+    FILE* f = fopen(path.c_str(), "w");
+    CHECK(f != nullptr);
+    {
+        OutputSink host = OutputSink::host_fd(fileno(f));
+        host.write(reinterpret_cast<const uint8_t*>("hello "), 6);
+        host.write(reinterpret_cast<const uint8_t*>("world"), 5);
+    }
+    IoRing::the().drain();
+    fclose(f);
+    std::ifstream in(path);
+    CHECK(std::string(std::istreambuf_iterator<char>(in), {}) == "hello world");
+    std::filesystem::remove(path);
+    return true;
+}
+
+bool Tester::minimizer_trim()
+{
+    /* Stands in for a run: the signature holds while both markers appear in order. */
+    auto keeps = [](std::string_view s) {
+        size_t key = s.find("KEY");
+        return key != std::string_view::npos
+            && s.find("END", key) != std::string_view::npos;
+    };
+
+    std::string input(2000, 'x');
+    input.replace(300, 3, "KEY");
+    input.replace(1500, 3, "END");
+    CHECK(Minimizer::trim(input, keeps) == "KEYEND");
+
+    /* Nothing is cut that the predicate needs. */
+    auto long_enough = [](std::string_view s) { return s.size() >= 10; };
+    CHECK(Minimizer::trim(input, long_enough).size() == 10);
+    return true;
+}
+
+bool Tester::virtio_dma_bounds()
+{
+    FileInfo* info = read_elf("../tests/elf/rv64ui-p-add", false);
+    CHECK(info->entry_point != ~0ULL);
+    VEmu em { info, std::vector<char*> {}, TEST_RAM_SIZE };
+    MMU* mmu = em.bus.get_mmu();
+    VirtioConsole* console = em.bus.get_console();
+    OutputSink out = OutputSink::capture(64);
+    console->set_output(&out);
+    auto reg = [console](uint64_t addr) { return console->load(addr, 32).first; };
+    auto set = [console](uint64_t addr, uint64_t value) {
+        console->store(addr, value, 32);
+    };
+
+    /* A four-entry transmitq: descriptors, then the avail and used rings. */
+    uint64_t desc = em.allocate_buffer(64);
+    uint64_t avail = em.allocate_buffer(16);
+    uint64_t used = em.allocate_buffer(40);
+    uint64_t text = em.allocate_buffer(8);
+    CHECK(mmu->dma_write(text, reinterpret_cast<const uint8_t*>("hiok"), 4));
+    auto setup = [&]() {
+        set(VIRTIO_STATUS, 0xf);
+        set(VIRTIO_QUEUE_SEL, 1);
+        set(VIRTIO_QUEUE_NUM, 4);
+        set(VIRTIO_QUEUE_DESC_LOW, desc);
+        set(VIRTIO_QUEUE_DRIVER_LOW, avail);
+        set(VIRTIO_QUEUE_DEVICE_LOW, used);
+        set(VIRTIO_QUEUE_READY, 1);
+    };
+    /* Posts a single-descriptor chain in slot `i` and notifies the device. */
+    auto transmit = [&](uint16_t i, uint64_t addr, uint32_t len) {
+        std::array<uint8_t, 16> d {};
+        memcpy(d.data(), &addr, 8);
+        memcpy(d.data() + 8, &len, 4);
+        auto idx = static_cast<uint16_t>(i + 1);
+        if (!mmu->dma_write(desc + 16 * i, d.data(), d.size())
+            || !mmu->dma_write(avail + 4 + 2 * i, reinterpret_cast<uint8_t*>(&i), 2)
+            || !mmu->dma_write(avail + 2, reinterpret_cast<uint8_t*>(&idx), 2))
+            return false;
+        set(VIRTIO_QUEUE_NOTIFY, 1);
+        return true;
+    };
+    auto needs_reset = [&reg]() {
+        return (reg(VIRTIO_STATUS) & VIRTIO_STATUS_DEVICE_NEEDS_RESET) != 0;
+    };
+
+    setup();
+    CHECK(transmit(0, text, 2));
+    CHECK(out.captured() == "hi");
+    CHECK(!needs_reset());
+
+    /* A buffer reaching past RAM breaks the device instead of being read. */
+    CHECK(transmit(1, TEST_RAM_SIZE - 2, 16));
+    CHECK(out.captured() == "hi");
+    CHECK(needs_reset());
+    CHECK((reg(VIRTIO_INTERRUPT_STATUS) & VIRTIO_INT_CONFIG) != 0);
+
+    /* It stays broken, whatever is posted next, until the driver resets it. */
+    CHECK(transmit(2, text + 2, 2));
+    CHECK(out.captured() == "hi");
+    set(VIRTIO_STATUS, 0);
+    CHECK(reg(VIRTIO_STATUS) == 0);
+
+    /* The same goes for rings outside of RAM. */
+    setup();
+    set(VIRTIO_QUEUE_DRIVER_HIGH, 0x100);
+    set(VIRTIO_QUEUE_NOTIFY, 1);
+    CHECK(needs_reset());
+    CHECK(out.captured() == "hi");
+    return true;
+}
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <type_traits>
 #include <unistd.h>
 
@@ -14,8 +16,6 @@ extern "C" {
 };
 #endif
 
-static constexpr bool VERBOSE_OUTPUT = false;
-
 VEmu::VEmu(std::string f_name, uint64_t start_pc, uint64_t mem_size)
     : bin_file_name(std::move(f_name))
     , bus(mem_size)
@@ -25,9 +25,9 @@ VEmu::VEmu(std::string f_name, uint64_t start_pc, uint64_t mem_size)
     mode = Mode::Machine;
     iregs = RegFile {};
     fregs = FRegFile {};
+    csrs.fill(0);
 #ifndef FUZZ_ENV
     mode = Mode::User;
-    csrs.fill(0);
     init_misa();
 #endif
     init_func_map();
@@ -51,13 +51,13 @@ VEmu::VEmu(FileInfo* info, const std::vector<char*>& args, uint64_t mem_size)
     // argv end
     push_to_stack(0, 64);
 
-    for (auto arg = args.rbegin(); arg != args.rend(); arg++) {
-        auto argval = bus.get_mmu()->allocate(256);
-        write_string_to_addr(*arg, argval);
+    for (size_t i = args.size(); i-- > 0;) {
+        auto argval = bus.get_mmu()->allocate(ARG_SIZE);
+        write_string_to_addr(args[i], argval);
         push_to_stack(argval, 64);
     }
 
-    auto argv0 = bus.get_mmu()->allocate(256);
+    auto argv0 = bus.get_mmu()->allocate(ARG_SIZE);
     write_string_to_addr(bin_file_name, argv0);
     push_to_stack(argv0, 64);
 
@@ -77,6 +77,189 @@ VEmu::VEmu(const std::vector<uint8_t>& bytes, uint64_t start_pc, uint64_t mem_si
     bus.get_mmu()->set_perms(base, code_size, PERM_EXEC | PERM_READ);
 }
 
+VEmu::VEmu(const VEmu& other)
+    : bin_file_name(other.bin_file_name)
+    , csrs(other.csrs)
+    , mode(other.mode)
+    , bus(other.bus)
+    , iregs(other.iregs)
+    , fregs(other.fregs)
+    , pc(other.pc)
+    , code_size(other.code_size)
+    , ram_size(other.ram_size)
+    , file_table(other.file_table)
+    , virtual_files(other.virtual_files)
+    , has_exited(other.has_exited)
+    , exit_code(other.exit_code)
+    , exit_pc(other.exit_pc)
+    , fault(other.fault)
+    , instruction_limit(other.instruction_limit)
+    , call_stack(other.call_stack)
+    , call_depth(other.call_depth)
+{
+    init_func_map();
+}
+
+void VEmu::reset_to(const VEmu& golden)
+{
+    bus.reset_to(golden.bus);
+
+    mode = golden.mode;
+    iregs = golden.iregs;
+    fregs = golden.fregs;
+    csrs = golden.csrs;
+    pc = golden.pc;
+    code_size = golden.code_size;
+    file_table = golden.file_table;
+    has_exited = golden.has_exited;
+    exit_code = golden.exit_code;
+    exit_pc = golden.exit_pc;
+    fault = golden.fault;
+    retired = 0;
+    call_stack = golden.call_stack;
+    call_depth = golden.call_depth;
+#ifdef TEST_ENV
+    test_flag_done = golden.test_flag_done;
+#endif
+}
+
+void VEmu::set_virtual_file(const std::string& pathname,
+                            std::shared_ptr<const char[]> data, uint64_t len)
+{
+    for (auto& vf : virtual_files) {
+        if (vf.pathname == pathname) {
+            vf.data = std::move(data);
+            vf.len = len;
+            return;
+        }
+    }
+    virtual_files.push_back(VirtualFile { pathname, std::move(data), len });
+}
+
+void VEmu::patch_memory(uint64_t addr, const uint8_t* data, uint64_t len)
+{
+    /* Only the host patches memory, and only inside the guest's RAM. */
+    [[maybe_unused]] bool in_ram = bus.get_mmu()->dma_write(addr, data, len);
+    assert(in_ram);
+}
+
+void VEmu::set_taint(TaintTracker* tracker)
+{
+    taint = tracker;
+    if (taint != nullptr)
+        bus.get_mmu()->enable_labels();
+}
+
+void VEmu::label_input(uint64_t addr, uint64_t len, uint64_t offset)
+{
+    if (taint == nullptr)
+        return;
+    for (uint64_t i = 0; i < len; i++)
+        bus.get_mmu()->set_label(addr + i, static_cast<uint32_t>(offset + i + 1));
+}
+
+static uint64_t sext12(uint32_t imm)
+{
+    auto value = static_cast<int32_t>(imm << 20) >> 20;
+    return static_cast<uint64_t>(static_cast<int64_t>(value));
+}
+
+/*
+ * Runs before the handler, while the source registers still hold the
+ * operands. Loads take the hull of the labels they read, stores spread the
+ * range of the stored register over the bytes they write. Results that do
+ * not depend on the input (immediates, links, syscall results, CSRs and
+ * floating point compares and moves) come out clean.
+ */
+void VEmu::propagate_taint()
+{
+    auto& regs = taint->regs;
+    MMU* mmu = bus.get_mmu();
+    uint32_t opcode = hex_instr & OPCODE_MASK;
+    uint32_t rd = (hex_instr >> 7) & 0x1F;
+    uint32_t funct3 = (hex_instr >> 12) & 0x7;
+    uint32_t rs1 = (hex_instr >> 15) & 0x1F;
+    uint32_t rs2 = (hex_instr >> 20) & 0x1F;
+    uint32_t funct7 = hex_instr >> 25;
+
+    auto load_labels = [&](uint64_t addr, uint64_t width) {
+        TaintRange r;
+        for (uint64_t i = 0; i < width; i++) {
+            uint32_t label = mmu->get_label(addr + i);
+            if (label != 0)
+                r = r | TaintRange { label - 1, label };
+        }
+        return r;
+    };
+
+    bool writes_rd = true;
+    TaintRange result;
+    switch (opcode) {
+    case 0x03: /* LOAD */
+        result = load_labels(iregs.load_reg(rs1) + sext12(hex_instr >> 20),
+                             1ULL << (funct3 & 0x3));
+        break;
+    case 0x2F: /* AMO, the store half is not followed */
+        result = load_labels(iregs.load_reg(rs1), 1ULL << (funct3 & 0x3));
+        break;
+    case 0x23: { /* STORE */
+        uint64_t addr = iregs.load_reg(rs1) + sext12((funct7 << 5) | rd);
+        const TaintRange& src = regs[rs2];
+        for (uint64_t i = 0; i < 1ULL << (funct3 & 0x3); i++) {
+            auto at = static_cast<uint32_t>(i);
+            uint32_t label = src.empty() ? 0 : std::min(src.lo + at, src.hi - 1) + 1;
+            /* Clean stores over clean memory leave the shadow untouched. */
+            if (label != 0 || mmu->get_label(addr + i) != 0)
+                mmu->set_label(addr + i, label);
+        }
+        writes_rd = false;
+        break;
+    }
+    case 0x13: /* OP-IMM */
+    case 0x1B: /* OP-IMM-32 */
+        result = regs[rs1];
+        break;
+    case 0x33: /* OP */
+    case 0x3B: /* OP-32 */
+        result = regs[rs1] | regs[rs2];
+        break;
+    case 0x63: /* BRANCH */
+        taint->record_branch(regs[rs1] | regs[rs2]);
+        writes_rd = false;
+        break;
+    case 0x53: /* OP-FP, only compares, conversions and moves to x registers */
+        writes_rd = funct7 >> 2 == 0x14 || funct7 >> 2 == 0x18 || funct7 >> 2 == 0x1C;
+        break;
+    case 0x73: /* SYSTEM, syscalls return in a0 */
+        if (funct3 == 0) {
+            regs[REG_A0] = {};
+            writes_rd = false;
+        }
+        break;
+    case 0x07: /* LOAD-FP */
+    case 0x27: /* STORE-FP */
+    case 0x43: /* FMADD */
+    case 0x47: /* FMSUB */
+    case 0x4B: /* FNMSUB */
+    case 0x4F: /* FNMADD */
+    case 0x0F: /* MISC-MEM */
+        writes_rd = false;
+        break;
+    default: /* LUI, AUIPC, JAL and JALR */
+        break;
+    }
+
+    if (writes_rd && rd != 0)
+        regs[rd] = result;
+}
+
+uint64_t VEmu::allocate_buffer(uint64_t len)
+{
+    auto base = bus.get_mmu()->allocate(len);
+    bus.get_mmu()->set_perms(base, len, PERM_READ | PERM_WRITE);
+    return base;
+}
+
 void VEmu::init_misa()
 {
     uint64_t misa = 0;
@@ -108,7 +291,7 @@ void VEmu::write_string_to_addr(const std::string& arg, uint64_t addr)
 
 void VEmu::init_func_map()
 {
-    inst_funcs = {
+    static const std::pair<IName, Handler> funcs[] = {
         {IName::LB,        &VEmu::LB      },
         { IName::LH,       &VEmu::LH      },
         { IName::LW,       &VEmu::LW      },
@@ -209,6 +392,7 @@ void VEmu::init_func_map()
 
         { IName::MRET,     &VEmu::MRET    },
         { IName::SRET,     &VEmu::SRET    },
+        { IName::WFI,      &VEmu::WFI     },
 
         { IName::FLW,      &VEmu::FLW     },
         { IName::FSW,      &VEmu::FSW     },
@@ -242,6 +426,10 @@ void VEmu::init_func_map()
 
         { IName::XXX,      &VEmu::XXX     },
     };
+
+    inst_funcs.fill(&VEmu::XXX);
+    for (const auto& [name, handler] : funcs)
+        inst_funcs[static_cast<size_t>(name)] = handler;
 }
 
 void VEmu::read_file()
@@ -277,6 +465,162 @@ std::array<int64_t, 32> VEmu::get_iregs() { return iregs.get_regs(); }
 
 std::array<double, 32> VEmu::get_fregs() { return fregs.get_regs(); }
 
+void VEmu::save_state(SnapshotWriter& w) const
+{
+    w.put(mode);
+    w.put(pc);
+    w.put(code_size);
+    w.put(ram_size);
+    w.put(iregs.get_regs());
+    w.put(fregs.get_regs());
+    w.put(csrs);
+    w.put(has_exited);
+    w.put(exit_code);
+    w.put_string(bin_file_name);
+
+    w.put<uint64_t>(file_table.size());
+    for (const FileHandle& fh : file_table) {
+        w.put(fh.fd);
+        w.put(fh.len);
+        w.put(fh.idx);
+        w.put(fh.type);
+        w.put_string(fh.pathname);
+        if (fh.data != nullptr)
+            w.put_bytes(fh.data.get(), fh.len);
+    }
+
+    bus.save(w);
+}
+
+bool VEmu::restore_state(SnapshotReader& r)
+{
+    mode = r.get<Mode>();
+    pc = r.get<uint64_t>();
+    code_size = r.get<uint64_t>();
+    if (r.get<uint64_t>() != ram_size)
+        return false;
+    iregs.set_regs(r.get<std::array<int64_t, RegFile::REGS_NUM>>());
+    fregs.set_regs(r.get<std::array<double, FRegFile::REGS_NUM>>());
+    csrs = r.get<decltype(csrs)>();
+    has_exited = r.get<bool>();
+    exit_code = r.get<uint8_t>();
+    bin_file_name = r.get_string();
+
+    /* Disk files are served from memory, so their contents travel with the
+     * snapshot and no host descriptor has to be reopened. */
+    file_table.clear();
+    auto files_num = r.get<uint64_t>();
+    for (uint64_t i = 0; i < files_num && r.ok(); i++) {
+        FileHandle fh {};
+        fh.fd = r.get<int>();
+        fh.len = r.get<uint64_t>();
+        fh.idx = r.get<uint64_t>();
+        fh.type = r.get<FileType>();
+        fh.pathname = r.get_string();
+        if (fh.type == FileType::DiskFile) {
+            if (!r.has(fh.len))
+                return false;
+            std::shared_ptr<char[]> data(new char[fh.len + 1]);
+            r.get_bytes(data.get(), fh.len);
+            data[fh.len] = '\0';
+            fh.data = data;
+        }
+        file_table.push_back(fh);
+    }
+
+    return bus.restore(r);
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool VEmu::save_snapshot(const std::string& path)
+{
+    SnapshotWriter w;
+    save_state(w);
+
+    SnapshotHeader header {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.state_offset = sizeof(SnapshotHeader);
+    header.state_size = w.data().size();
+    header.ram_offset = align_up(header.state_offset + header.state_size,
+                                 SNAPSHOT_SECTION_ALIGN);
+    header.perms_offset = align_up(header.ram_offset + ram_size, SNAPSHOT_SECTION_ALIGN);
+    header.ram_size = ram_size;
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return false;
+
+    /* Sizing the file up front leaves never-touched guest pages as holes. */
+    bool ok = ftruncate(fd, (off_t)(header.perms_offset + ram_size)) == 0
+        && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+        && pwrite(fd, w.data().data(), w.data().size(), (off_t)header.state_offset)
+            == (ssize_t)w.data().size()
+        && bus.get_mmu()->save_sections(fd, header.ram_offset, header.perms_offset);
+
+    close(fd);
+    return ok;
+}
+
+/*
+ * Checks that every section the header points at lies within the file, so
+ * nothing is sized or mapped from a value the file cannot back.
+ */
+static bool snapshot_fits(const SnapshotHeader& header, uint64_t file_size)
+{
+    auto fits = [file_size](uint64_t offset, uint64_t len) {
+        return offset <= file_size && len <= file_size - offset;
+    };
+
+    return header.state_offset >= sizeof(SnapshotHeader)
+        && fits(header.state_offset, header.state_size)
+        && fits(header.ram_offset, header.ram_size)
+        && fits(header.perms_offset, header.ram_size);
+}
+
+bool VEmu::restore_snapshot(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    SnapshotHeader header {};
+    struct stat st {};
+    if (fstat(fd, &st) != 0
+        || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+        || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SNAPSHOT_VERSION || header.ram_size != ram_size
+        || !snapshot_fits(header, static_cast<uint64_t>(st.st_size))) {
+        close(fd);
+        return false;
+    }
+
+    std::vector<uint8_t> state(header.state_size);
+    if (pread(fd, state.data(), state.size(), (off_t)header.state_offset)
+        != (ssize_t)state.size()) {
+        close(fd);
+        return false;
+    }
+
+    /* Any failure rolls the machine back to the state it had before. */
+    SnapshotWriter backup;
+    save_state(backup);
+    SnapshotReader r(state.data(), state.size());
+    bool ok = restore_state(r)
+        && bus.get_mmu()->map_sections(fd, header.ram_offset, header.perms_offset,
+                                       header.ram_size);
+    close(fd);
+    if (!ok) {
+        SnapshotReader undo(backup.data().data(), backup.data().size());
+        restore_state(undo);
+    }
+    return ok;
+}
+
 ReturnException VEmu::store(uint64_t addr, uint64_t data, size_t sz)
 {
     return bus.store(addr, data, sz);
@@ -300,13 +644,25 @@ std::pair<uint32_t, ReturnException> VEmu::get_4byte_aligned_instr(uint64_t i)
 }
 
 uint32_t VEmu::run()
+{
+    run_until(~0ULL);
+    return get_exit_code();
+}
+
+bool VEmu::run_until(uint64_t stop_pc)
 {
     for (;; pc += 4) {
 
         if (has_exited) {
-            return exit_code;
+            return false;
         }
 
+        if (pc == stop_pc)
+            return true;
+
+        if (retired == instruction_limit)
+            return false;
+
 #ifndef FUZZ_ENV
         Interrupt i = check_pending_interrupt();
         if (i != Interrupt::NoInterrupt) {
@@ -316,26 +672,34 @@ uint32_t VEmu::run()
 
 #ifdef TEST_ENV
         if (test_flag_done)
-            return 0;
+            return false;
 #endif
         auto aligned_instr = get_4byte_aligned_instr(pc);
         if (aligned_instr.second != ReturnException::NormalExecutionReturn)
             trap(aligned_instr.second);
-        if (is_fatal(aligned_instr.second))
+        if (is_fatal(aligned_instr.second)) {
             exit_fatally(aligned_instr.second);
+            continue;
+        }
 
         hex_instr = aligned_instr.first;
 
-        curr_instr = InstructionDecoder::the().decode(hex_instr);
+        DecodedInsn& decoded = decode_cache[(pc >> 2) % DECODE_CACHE_SIZE];
+        if (decoded.pc != pc || decoded.hex != hex_instr)
+            decoded = { pc, hex_instr, InstructionDecoder::the().decode(hex_instr) };
+        curr_instr = decoded.insn;
         IName instr_iname = curr_instr.get_name();
+        if (taint != nullptr)
+            propagate_taint();
 
-        auto ret = (inst_funcs[instr_iname])(this);
+        auto ret = (this->*inst_funcs[static_cast<size_t>(instr_iname)])();
+        retired++;
         if (ret != ReturnException::NormalExecutionReturn)
             trap(ret);
         if (is_fatal(ret))
             exit_fatally(ret);
     }
-    return 0;
+    return false;
 }
 
 uint64_t VEmu::load_csr(uint64_t addr)
@@ -379,7 +743,9 @@ template <typename T> uint64_t sext_from(T w)
 
 ReturnException VEmu::LB()
 {
-    LBU();
+    auto ret = LBU();
+    if (ret != ReturnException::NormalExecutionReturn)
+        return ret;
 
     auto rd = curr_instr.get_fields().rd;
 
@@ -391,7 +757,9 @@ ReturnException VEmu::LB()
 
 ReturnException VEmu::LW()
 {
-    LWU();
+    auto ret = LWU();
+    if (ret != ReturnException::NormalExecutionReturn)
+        return ret;
 
     auto rd = curr_instr.get_fields().rd;
 
@@ -426,7 +794,9 @@ ReturnException VEmu::LBU()
 
 ReturnException VEmu::LH()
 {
-    LHU();
+    auto ret = LHU();
+    if (ret != ReturnException::NormalExecutionReturn)
+        return ret;
 
     auto rd = curr_instr.get_fields().rd;
 
@@ -539,6 +909,7 @@ ReturnException VEmu::SLTI()
 
     auto rd = curr_instr.get_fields().rd;
     auto rs1 = curr_instr.get_fields().rs1;
+    record_cmp(iregs.load_reg(rs1), imm);
 
     auto res = (iregs.load_reg(rs1) < imm) ? 1 : 0;
     iregs.store_reg(rd, res);
@@ -553,6 +924,7 @@ ReturnException VEmu::SLTIU()
 
     auto rd = curr_instr.get_fields().rd;
     auto rs1 = curr_instr.get_fields().rs1;
+    record_cmp(iregs.load_reg(rs1), imm);
 
     auto res = (static_cast<uint64_t>(iregs.load_reg(rs1)) < static_cast<uint64_t>(imm))
         ? 1
@@ -695,173 +1067,7 @@ ReturnException VEmu::FENCEI() { return ReturnException::NormalExecutionReturn;
 #ifdef FUZZ_ENV
 ReturnException VEmu::ECALL()
 {
-    auto syscall_number = iregs.load_reg(REG_A7);
-    if (syscall_number == SYSCALL_NR_BRK) {
-        uint64_t addr = iregs.load_reg(REG_A0);
-        int64_t increment
-            = addr == 0 ? 0 : (int64_t)addr - (int64_t)bus.get_mmu()->cur_alloc_ptr();
-        if (increment < 0) {
-            iregs.store_reg(REG_A0, ~0);
-        } else {
-            auto ret_base = bus.get_mmu()->allocate(increment);
-            iregs.store_reg(REG_A0, ret_base + increment);
-        }
-    } else if (syscall_number == SYSCALL_NR_WRITE) {
-        if (VERBOSE_OUTPUT) {
-            int64_t fd = iregs.load_reg(REG_A0);
-            uint64_t buf = iregs.load_reg(REG_A1);
-            size_t count = iregs.load_reg(REG_A2);
-            auto str = bus.get_mmu()->read_to(buf, count).first;
-            std::string s(str.begin(), str.end());
-            if (fd == 1 || fd == 2) {
-                std::cout << s;
-                iregs.store_reg(REG_A0, count);
-            }
-        } else {
-            size_t count = iregs.load_reg(REG_A2);
-            iregs.store_reg(REG_A0, count);
-        }
-    } else if (syscall_number == SYSCALL_NR_OPEN) {
-        auto pathname = iregs.load_reg(REG_A0);
-        auto flags = iregs.load_reg(REG_A1);
-        auto p = bus.get_mmu()->_read_null_terminated_string(pathname);
-        int fd = open(p.c_str(), (int)flags);
-        assert(fd != -1);
-        if (fd == -1) {
-            iregs.store_reg(REG_A0, -1);
-            return ReturnException::NormalExecutionReturn;
-        }
-
-        uint64_t file_size = lseek(fd, 0, SEEK_END);
-        lseek(fd, 0, SEEK_SET);
-        char* buffer = (char*)malloc(file_size + 1);
-        assert(buffer);
-        int64_t r = read(fd, buffer, file_size);
-        (void)r;
-        buffer[file_size] = '\0';
-        char* fname = (char*)malloc(p.size() + 1);
-        strcpy(fname, p.c_str());
-        file_table.push_back(FileHandle { buffer, (const char*)fname, fd, file_size, 0,
-                                          FileType::DiskFile });
-        iregs.store_reg(REG_A0, fd);
-    } else if (syscall_number == SYSCALL_NR_CLOSE) {
-        int fd = (int)iregs.load_reg(REG_A0);
-        int entry_idx = -1;
-        for (size_t i = 0; i < file_table.size(); i++) {
-            if (file_table[i].fd == fd) {
-                entry_idx = (int)i;
-                break;
-            }
-        }
-        if (entry_idx == -1) {
-            exit_emu(12);
-        } else {
-            file_table.erase(std::begin(file_table) + entry_idx);
-        }
-        return ReturnException::NormalExecutionReturn;
-    } else if (syscall_number == SYSCALL_NR_EXIT) {
-        auto _exit_code = (int)iregs.load_reg(REG_A0);
-        if (_exit_code == 11)
-            std::cout << "Crash Detected" << std::endl;
-        exit_emu((uint8_t)(_exit_code % 255));
-        return ReturnException::NormalExecutionReturn;
-    } else if (syscall_number == SYSCALL_NR_FSTAT) {
-        int64_t fd = iregs.load_reg(REG_A0);
-        uint64_t statbuf = iregs.load_reg(REG_A1);
-        bool exists = false;
-        for (auto fh : file_table) {
-            if (fh.fd == (int)fd) {
-                exists = true;
-                break;
-            }
-        }
-        assert(exists);
-
-        struct riscv_stat {
-            uint64_t _st_dev;
-            uint64_t _st_ino;
-            uint32_t _st_mode;
-            uint32_t _st_nlink;
-            uint32_t _st_uid;
-            uint32_t _st_gid;
-            uint64_t _st_rdev;
-            uint64_t _ppad1;
-            int64_t _st_size;
-            int32_t _st_blksize;
-            int32_t _ppad2;
-            uint64_t _st_blocks;
-            uint64_t _st_atime;
-            uint64_t _st_atimensec;
-            uint64_t _st_mtime;
-            uint64_t _st_mtimensec;
-            uint64_t _st_ctime;
-            uint64_t _st_ctimensec;
-            int __glibc_reserved[2];
-        } st;
-
-        st._st_dev = (fd == 1) ? 0x18 : 0x802;
-        st._st_ino = (fd == 1) ? 0x3 : 0x22068c;
-        st._st_mode = (fd == 1) ? 0x2190 : 0x81fd;
-        st._st_nlink = 0x1;
-        st._st_uid = 0x3e8;
-        st._st_gid = (fd == 1) ? 0x5 : 0x3e8;
-        st._st_rdev = (fd == 1) ? 0x8800 : 0x0;
-        st._st_size = (fd == 1) ? 0x0 : file_table.back().len;
-        st._st_blksize = (fd == 1) ? 0x400 : 0x1000;
-        st._st_blocks = (fd == 1) ? 0x0 : file_table.back().len / st._st_blksize;
-        st._st_atime = 0x6440824f;
-        st._st_mtime = 0x6440824a;
-        st._st_ctime = 0x6440824a;
-
-        auto ptr = reinterpret_cast<uint8_t*>(&st);
-        std::vector<uint8_t> bytes(ptr, ptr + sizeof(riscv_stat));
-        bus.get_mmu()->write_from(bytes, statbuf);
-        iregs.store_reg(REG_A0, 0);
-    } else if (syscall_number == SYSCALL_NR_LSEEK) {
-        int64_t file = iregs.load_reg(REG_A0);
-        int64_t offset = iregs.load_reg(REG_A1);
-        int64_t whence = iregs.load_reg(REG_A2);
-        for (auto& fh : file_table) {
-            if (fh.fd == file) {
-                if (whence == SEEK_SET)
-                    fh.idx = offset;
-                else if (whence == SEEK_CUR)
-                    fh.idx += offset;
-                else if (whence == SEEK_END)
-                    fh.idx = fh.len + offset;
-                else
-                    assert(false);
-                iregs.store_reg(REG_A0, fh.idx);
-                return ReturnException::NormalExecutionReturn;
-            }
-        }
-        iregs.store_reg(REG_A0, -1);
-    } else if (syscall_number == SYSCALL_NR_READ) {
-        int64_t fd = iregs.load_reg(REG_A0);
-        uint64_t buf = iregs.load_reg(REG_A1);
-        uint64_t count = iregs.load_reg(REG_A2);
-        for (auto& fh : file_table) {
-            if (fh.fd == fd) {
-                const uint8_t* data_start = (const uint8_t*)fh.data;
-                if (fh.idx + count >= fh.len)
-                    count = fh.len - fh.idx;
-                if (count == 0)
-                    return ReturnException::NormalExecutionReturn;
-                std::vector<uint8_t> data(data_start + fh.idx,
-                                          data_start + fh.idx + count);
-                fh.idx += count;
-                bus.get_mmu()->write_from(data, buf);
-                iregs.store_reg(REG_A0, count);
-                return ReturnException::NormalExecutionReturn;
-            }
-        }
-        assert(false);
-    } else {
-        std::cout << "Unsupported syscall: " << std::dec << syscall_number << ", pc: 0x"
-                  << std::hex << pc << '\n';
-        exit(EXIT_FAILURE);
-    }
-
+    handle_syscall();
     return ReturnException::NormalExecutionReturn;
 }
 #elif defined(TEST_ENV)
@@ -1004,8 +1210,10 @@ ReturnException VEmu::CSRRCI()
 
 ReturnException VEmu::BEQ()
 {
+    const uint64_t from = pc;
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1015,13 +1223,17 @@ ReturnException VEmu::BEQ()
         this->pc -= 4;
     }
 
+    record_edge(from);
+
     return ReturnException::NormalExecutionReturn;
 }
 
 ReturnException VEmu::BNE()
 {
+    const uint64_t from = pc;
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1031,13 +1243,17 @@ ReturnException VEmu::BNE()
         this->pc -= 4;
     }
 
+    record_edge(from);
+
     return ReturnException::NormalExecutionReturn;
 }
 
 ReturnException VEmu::BLT()
 {
+    const uint64_t from = pc;
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1047,13 +1263,17 @@ ReturnException VEmu::BLT()
         this->pc -= 4;
     }
 
+    record_edge(from);
+
     return ReturnException::NormalExecutionReturn;
 }
 
 ReturnException VEmu::BGE()
 {
+    const uint64_t from = pc;
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1063,13 +1283,17 @@ ReturnException VEmu::BGE()
         this->pc -= 4;
     }
 
+    record_edge(from);
+
     return ReturnException::NormalExecutionReturn;
 }
 
 ReturnException VEmu::BLTU()
 {
+    const uint64_t from = pc;
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1080,13 +1304,17 @@ ReturnException VEmu::BLTU()
         this->pc -= 4;
     }
 
+    record_edge(from);
+
     return ReturnException::NormalExecutionReturn;
 }
 
 ReturnException VEmu::BGEU()
 {
+    const uint64_t from = pc;
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1097,6 +1325,8 @@ ReturnException VEmu::BGEU()
         this->pc -= 4;
     }
 
+    record_edge(from);
+
     return ReturnException::NormalExecutionReturn;
 }
 
@@ -1180,6 +1410,7 @@ ReturnException VEmu::SUB()
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
     auto rd = curr_instr.get_fields().rd;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     auto res = iregs.load_reg(rs1) - iregs.load_reg(rs2);
     iregs.store_reg(rd, res);
@@ -1192,6 +1423,7 @@ ReturnException VEmu::SUBW()
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
     auto rd = curr_instr.get_fields().rd;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     int32_t op1 = static_cast<int32_t>(iregs.load_reg(rs1));
     int32_t op2 = static_cast<int32_t>(iregs.load_reg(rs2));
@@ -1244,6 +1476,7 @@ ReturnException VEmu::SLT()
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
     auto rd = curr_instr.get_fields().rd;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     auto res = (iregs.load_reg(rs1) < iregs.load_reg(rs2)) ? 1 : 0;
     iregs.store_reg(rd, res);
@@ -1256,6 +1489,7 @@ ReturnException VEmu::SLTU()
     auto rs1 = curr_instr.get_fields().rs1;
     auto rs2 = curr_instr.get_fields().rs2;
     auto rd = curr_instr.get_fields().rd;
+    record_cmp(iregs.load_reg(rs1), iregs.load_reg(rs2));
 
     auto res = (static_cast<uint64_t>(iregs.load_reg(rs1))
                 < static_cast<uint64_t>(iregs.load_reg(rs2)))
@@ -1623,6 +1857,7 @@ ReturnException VEmu::AND()
 
 ReturnException VEmu::JAL()
 {
+    const uint64_t from = pc;
     auto rd = curr_instr.get_fields().rd;
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
     int64_t imm = static_cast<int64_t>(imm_32);
@@ -1633,11 +1868,15 @@ ReturnException VEmu::JAL()
     this->pc += imm;
     this->pc -= 4;
 
+    record_edge(from);
+    record_call(rd, from + 4);
+
     return ReturnException::NormalExecutionReturn;
 }
 
 ReturnException VEmu::JALR()
 {
+    const uint64_t from = pc;
     auto rd = curr_instr.get_fields().rd;
     auto rs1 = curr_instr.get_fields().rs1;
     int32_t imm_32 = static_cast<int32_t>(curr_instr.get_fields().imm);
@@ -1651,6 +1890,10 @@ ReturnException VEmu::JALR()
     this->pc &= ~(0x1);
     this->pc -= 4;
 
+    record_edge(from);
+    record_return(rd, rs1);
+    record_call(rd, from + 4);
+
     return ReturnException::NormalExecutionReturn;
 }
 
@@ -2372,6 +2615,38 @@ ReturnException VEmu::SRET()
     return ReturnException::NormalExecutionReturn;
 }
 
+static constexpr auto WFI_MAX_SLEEP = std::chrono::milliseconds(10);
+
+/*
+ * Parks the host thread until an interrupt is locally pending. The hart wakes on
+ * the next timer deadline or when a device rings the bus, whether or not the
+ * interrupt is globally enabled, as the specification requires. WFI may also
+ * complete spuriously, so the sleep is bounded and the guest's idle loop simply
+ * waits again. That keeps a hart with its interrupts masked stoppable.
+ */
+ReturnException VEmu::WFI()
+{
+#ifndef FUZZ_ENV
+    if (mode == Mode::User)
+        return ReturnException::IllegalInstruction;
+    if (mode == Mode::Supervisor && ((load_csr(MSTATUS) >> MSTATUS_TW_POS) & 1) != 0)
+        return ReturnException::IllegalInstruction;
+
+    update_external_interrupts();
+    update_timer_interrupt();
+    /* With no interrupt enabled nothing could end the wait, so it is a NOP. */
+    uint64_t mie = load_csr(MIE);
+    if (mie == 0 || (mie & load_csr(MIP)) != 0)
+        return ReturnException::NormalExecutionReturn;
+
+    auto deadline = std::chrono::steady_clock::now() + WFI_MAX_SLEEP;
+    if (((mie >> MIP_MTIP_POS) & 1) != 0)
+        deadline = std::min(deadline, bus.get_clint()->timer_deadline());
+    bus.wait_for_interrupt(deadline);
+#endif
+    return ReturnException::NormalExecutionReturn;
+}
+
 ReturnException VEmu::XXX()
 {
     std::ios_base::fmtflags ft { std::cout.flags() };
@@ -2383,14 +2658,68 @@ ReturnException VEmu::XXX()
     return ReturnException::IllegalInstruction;
 }
 
+/* Guest descriptors are numbered like the host would, lowest free one first. */
+int VEmu::alloc_fd()
+{
+    for (size_t fd = 0; fd < file_table.size(); fd++) {
+        if (file_table[fd].type == FileType::Closed)
+            return static_cast<int>(fd);
+    }
+    file_table.push_back(FileHandle { nullptr, "", 0, 0, 0, FileType::Closed });
+    return static_cast<int>(file_table.size() - 1);
+}
+
 void VEmu::exit_emu(uint8_t _exit_code)
 {
     has_exited = true;
     exit_code = _exit_code;
+    exit_pc = pc;
+}
+
+VEmu::StopSite VEmu::stop_site() const
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint32_t frames = std::min(call_depth, STACK_HASH_FRAMES);
+    for (uint32_t i = 1; i <= frames; i++)
+        hash = (hash ^ call_stack[(call_depth - i) % CALL_STACK_SIZE]) * 0x100000001B3ULL;
+    return { has_exited ? exit_pc : pc, hash };
+}
+
+/*
+ * MEIP and SEIP mirror the interrupt lines of the PLIC contexts of this hart.
+ * The guest lowers them by claiming the interrupt from the PLIC.
+ */
+void VEmu::update_external_interrupts()
+{
+    bus.poll_interrupts();
+
+    const PLIC* plic = bus.get_plic();
+    uint64_t mip = load_csr(MIP) & ~((1U << MIP_MEIP_POS) | (1U << MIP_SEIP_POS));
+    if (plic->is_pending(PLIC_CONTEXT_M))
+        mip |= (1U << MIP_MEIP_POS);
+    if (plic->is_pending(PLIC_CONTEXT_S))
+        mip |= (1U << MIP_SEIP_POS);
+    store_csr(MIP, mip);
+}
+
+/* MTIP follows the CLINT comparator, the guest lowers it by moving mtimecmp. */
+void VEmu::update_timer_interrupt()
+{
+    const CLINT* clint = bus.get_clint();
+    if (!clint->timer_armed())
+        return;
+
+    uint64_t mip = load_csr(MIP) & ~(1U << MIP_MTIP_POS);
+    if (clint->timer_pending())
+        mip |= (1U << MIP_MTIP_POS);
+    store_csr(MIP, mip);
 }
 
 Interrupt VEmu::check_pending_interrupt()
 {
+    update_external_interrupts();
+    update_timer_interrupt();
+
     if (mode == Mode::Machine) {
         if (((load_csr(MSTATUS) >> MSTATUS_MIE_POS) & 1) == 0) {
             return Interrupt::NoInterrupt;
@@ -2401,13 +2730,6 @@ Interrupt VEmu::check_pending_interrupt()
         }
     }
 
-    uint32_t irq = bus.uart_is_interrupting() ? UART_IRQ : 0;
-
-    if (irq == UART_IRQ) {
-        bus.store(PLIC_SCLAIM, 32, irq);
-        store_csr(MIP, load_csr(MIP) | (1U << MIP_SEIP_POS));
-    }
-
     const auto is_pending = [this](uint64_t interrupt_pos) -> bool {
         /* Check if the interrupt is enabled AND pending */
         uint64_t pending = load_csr(MIE) & load_csr(MIP);
@@ -2552,9 +2874,22 @@ bool VEmu::is_fatal(ReturnException e)
         || e == ReturnException::InstructionAccessFault
         || e == ReturnException::InstructionAddressMisaligned
         || e == ReturnException::StoreAMOAddressMisaligned
-        || e == ReturnException::StoreAMOAccessFault;
+        || e == ReturnException::StoreAMOAccessFault
+#ifdef FUZZ_ENV
+        /* Reading memory that was never mapped readable, like a segfault. */
+        || e == ReturnException::ReadMemoryWithNoPermission
+#endif
+        ;
 }
 
+#ifdef FUZZ_ENV
+/* A fatal trap is a crash of the target, the fuzzer goes on with the next run. */
+void VEmu::exit_fatally(ReturnException e)
+{
+    fault = e;
+    exit_emu(CRASH_EXIT_CODE);
+}
+#else
 void VEmu::exit_fatally(ReturnException e)
 {
     std::cout << "Exit on exception: " << stringify_exception(e);
@@ -2564,6 +2899,7 @@ void VEmu::exit_fatally(ReturnException e)
 
     exit(EXIT_FAILURE);
 }
+#endif
 
 std::string VEmu::stringify_exception(ReturnException e)
 {
@@ -0,0 +1,434 @@
+#include <algorithm>
+
+#include <IoRing.h>
+#include <VirtioConsole.h>
+
+static constexpr uint64_t VIRTIO_F_VERSION_1_WORD = 1; // Bit 32 of the features.
+static constexpr uint32_t VIRTIO_CONSOLE_F_EMERG_WRITE = 1 << 2;
+static constexpr uint16_t CONSOLE_COLS = 80;
+static constexpr uint16_t CONSOLE_ROWS = 25;
+
+VirtioConsole::VirtioConsole(MMU* _mmu)
+    : mmu(_mmu)
+{
+}
+
+VirtioConsole::VirtioConsole(const VirtioConsole& other, MMU* _mmu)
+    : Device(other)
+    , mmu(_mmu)
+    , queues(other.queues)
+    , queue_sel(other.queue_sel)
+    , device_features_sel(other.device_features_sel)
+    , driver_features_sel(other.driver_features_sel)
+    , driver_features(other.driver_features)
+    , status(other.status)
+    , interrupt_status(other.interrupt_status)
+    , sink(other.sink == &other.host_out ? &host_out : other.sink)
+{
+}
+
+std::pair<uint64_t, ReturnException> VirtioConsole::load(uint64_t addr, size_t sz)
+{
+    std::pair<uint64_t, ReturnException> res;
+    res.second = ReturnException::NormalExecutionReturn;
+
+    if (addr >= VIRTIO_CONFIG) {
+        res.first = load_config(addr, sz);
+        return res;
+    }
+
+    switch (sz) {
+    case 32:
+        res.first = load32(addr);
+        break;
+    default:
+        res.second = ReturnException::LoadAccessFault;
+        break;
+    }
+
+    return res;
+}
+
+ReturnException VirtioConsole::store(uint64_t addr, uint64_t value, size_t sz)
+{
+    ReturnException res;
+    res = ReturnException::NormalExecutionReturn;
+
+    /* The emergency write field of the configuration space. */
+    if (addr == VIRTIO_CONFIG + 8) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto c = static_cast<uint8_t>(value);
+        write_output(&c, 1);
+        return res;
+    }
+
+    switch (sz) {
+    case 32:
+        store32(addr, static_cast<uint32_t>(value));
+        break;
+    default:
+        res = ReturnException::StoreAMOAccessFault;
+        break;
+    }
+
+    return res;
+}
+
+void VirtioConsole::save(SnapshotWriter& w) const
+{
+    w.put(queues);
+    w.put(queue_sel);
+    w.put(device_features_sel);
+    w.put(driver_features_sel);
+    w.put(driver_features);
+    w.put(status);
+    w.put(interrupt_status);
+}
+
+void VirtioConsole::restore(SnapshotReader& r)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    queues = r.get<decltype(queues)>();
+    queue_sel = r.get<uint32_t>();
+    device_features_sel = r.get<uint32_t>();
+    driver_features_sel = r.get<uint32_t>();
+    driver_features = r.get<uint64_t>();
+    status = r.get<uint32_t>();
+    interrupt_status = r.get<uint32_t>();
+}
+
+void VirtioConsole::push_input(const char* data, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    rx_pending.append(data, len);
+    if (!process_receiveq())
+        needs_reset();
+}
+
+uint32_t VirtioConsole::load32(uint64_t addr) const
+{
+    switch (addr) {
+    case VIRTIO_MAGIC:
+        return VIRTIO_MAGIC_VALUE;
+    case VIRTIO_VERSION:
+        return 2;
+    case VIRTIO_DEVICE_ID:
+        return VIRTIO_CONSOLE_DEVICE_ID;
+    case VIRTIO_VENDOR_ID:
+        return VIRTIO_VENDOR_VALUE;
+    case VIRTIO_DEVICE_FEATURES:
+        if (device_features_sel == 0)
+            return VIRTIO_CONSOLE_F_EMERG_WRITE;
+        return device_features_sel == 1 ? VIRTIO_F_VERSION_1_WORD : 0;
+    case VIRTIO_QUEUE_NUM_MAX:
+        return queue_sel < QUEUES_NUM ? QUEUE_NUM_MAX : 0;
+    case VIRTIO_QUEUE_READY:
+        return queue_sel < QUEUES_NUM ? queues[queue_sel].ready : 0;
+    case VIRTIO_INTERRUPT_STATUS:
+        return interrupt_status;
+    case VIRTIO_STATUS:
+        return status;
+    case VIRTIO_CONFIG_GENERATION:
+        return 0;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+void VirtioConsole::store32(uint64_t addr, uint32_t data)
+{
+    std::lock_guard<std::mutex> lock(mu);
+
+    switch (addr) {
+    case VIRTIO_QUEUE_SEL:
+        queue_sel = data;
+        break;
+    case VIRTIO_DEVICE_FEATURES_SEL:
+        device_features_sel = data;
+        break;
+    case VIRTIO_DRIVER_FEATURES_SEL:
+        driver_features_sel = data;
+        break;
+    case VIRTIO_DRIVER_FEATURES:
+        if (driver_features_sel == 0) {
+            driver_features = (driver_features & ~0xFFFFFFFFULL) | data;
+        } else if (driver_features_sel == 1) {
+            driver_features = (driver_features & 0xFFFFFFFFULL)
+                | (static_cast<uint64_t>(data) << 32);
+        }
+        break;
+    case VIRTIO_QUEUE_NOTIFY:
+        notify(data);
+        break;
+    case VIRTIO_INTERRUPT_ACK:
+        interrupt_status &= ~data;
+        break;
+    case VIRTIO_STATUS:
+        /* Only a reset clears DEVICE_NEEDS_RESET. */
+        if (data == 0)
+            reset();
+        else
+            status = data | (status & VIRTIO_STATUS_DEVICE_NEEDS_RESET);
+        break;
+    default:
+        /* Writes to the registers of a non-existent queue are ignored. */
+        if (queue_sel < QUEUES_NUM)
+            store_queue_reg(queues[queue_sel], addr, data);
+        break;
+    }
+}
+
+void VirtioConsole::store_queue_reg(VirtQueue& q, uint64_t addr, uint32_t data)
+{
+    switch (addr) {
+    case VIRTIO_QUEUE_NUM:
+        q.num = std::min(data, QUEUE_NUM_MAX);
+        break;
+    case VIRTIO_QUEUE_READY:
+        q.ready = data & 1;
+        break;
+    case VIRTIO_QUEUE_DESC_LOW:
+        q.desc = (q.desc & ~0xFFFFFFFFULL) | data;
+        break;
+    case VIRTIO_QUEUE_DESC_HIGH:
+        q.desc = (q.desc & 0xFFFFFFFFULL) | (static_cast<uint64_t>(data) << 32);
+        break;
+    case VIRTIO_QUEUE_DRIVER_LOW:
+        q.driver = (q.driver & ~0xFFFFFFFFULL) | data;
+        break;
+    case VIRTIO_QUEUE_DRIVER_HIGH:
+        q.driver = (q.driver & 0xFFFFFFFFULL) | (static_cast<uint64_t>(data) << 32);
+        break;
+    case VIRTIO_QUEUE_DEVICE_LOW:
+        q.device = (q.device & ~0xFFFFFFFFULL) | data;
+        break;
+    case VIRTIO_QUEUE_DEVICE_HIGH:
+        q.device = (q.device & 0xFFFFFFFFULL) | (static_cast<uint64_t>(data) << 32);
+        break;
+    default:
+        break;
+    }
+}
+
+uint64_t VirtioConsole::load_config(uint64_t addr, size_t sz) const
+{
+    /* struct virtio_console_config { u16 cols; u16 rows; u32 max_nr_ports; u32
+     * emerg_wr; } */
+    std::array<uint8_t, 12> config {};
+    config[0] = CONSOLE_COLS & 0xFF;
+    config[1] = CONSOLE_COLS >> 8;
+    config[2] = CONSOLE_ROWS & 0xFF;
+    config[3] = CONSOLE_ROWS >> 8;
+    config[4] = 1;
+
+    uint64_t res = 0;
+    uint64_t off = addr - (VIRTIO_CONFIG);
+    for (uint64_t i = 0; i < sz / 8 && off + i < config.size(); i++)
+        res |= static_cast<uint64_t>(config[off + i]) << (8 * i);
+
+    return res;
+}
+
+void VirtioConsole::reset()
+{
+    queues = {};
+    queue_sel = 0;
+    device_features_sel = 0;
+    driver_features_sel = 0;
+    driver_features = 0;
+    status = 0;
+    interrupt_status = 0;
+}
+
+/* A console is interactive, so each batch reaches the host before the guest goes on. */
+void VirtioConsole::write_output(const uint8_t* data, uint64_t len)
+{
+    if (sink == nullptr)
+        return;
+    sink->write(data, len);
+    sink->flush();
+    IoRing::the().drain();
+}
+
+/*
+ * A guest that points a queue outside of RAM gets a device that stops
+ * processing until it is reset, never a host access out of bounds.
+ */
+void VirtioConsole::needs_reset()
+{
+    status |= VIRTIO_STATUS_DEVICE_NEEDS_RESET;
+    interrupt_status |= VIRTIO_INT_CONFIG;
+    raise_irq();
+}
+
+void VirtioConsole::notify(uint32_t queue_idx)
+{
+    bool ok = true;
+    switch (queue_idx) {
+    case TRANSMITQ:
+        ok = process_transmitq();
+        break;
+    case RECEIVEQ:
+        ok = process_receiveq();
+        break;
+    default:
+        break;
+    }
+    if (!ok)
+        needs_reset();
+}
+
+bool VirtioConsole::load_avail_idx(const VirtQueue& q, uint16_t& idx) const
+{
+    return mmu->dma_read(q.driver + 2, reinterpret_cast<uint8_t*>(&idx), sizeof(idx));
+}
+
+bool VirtioConsole::load_avail_ring(const VirtQueue& q, uint16_t i, uint16_t& head) const
+{
+    uint64_t addr = q.driver + 4 + 2 * (i % q.num);
+    return mmu->dma_read(addr, reinterpret_cast<uint8_t*>(&head), sizeof(head));
+}
+
+bool VirtioConsole::load_desc(const VirtQueue& q, uint16_t i, VirtqDesc& d) const
+{
+    return mmu->dma_read(q.desc + 16 * (i % q.num), reinterpret_cast<uint8_t*>(&d),
+                         sizeof(d));
+}
+
+bool VirtioConsole::push_used(VirtQueue& q, uint32_t id, uint32_t len)
+{
+    uint16_t used_idx = 0;
+    if (!mmu->dma_read(q.device + 2, reinterpret_cast<uint8_t*>(&used_idx),
+                       sizeof(used_idx)))
+        return false;
+
+    std::array<uint32_t, 2> elem { id, len };
+    if (!mmu->dma_write(q.device + 4 + 8 * (used_idx % q.num),
+                        reinterpret_cast<const uint8_t*>(elem.data()), sizeof(elem)))
+        return false;
+
+    used_idx++;
+    return mmu->dma_write(q.device + 2, reinterpret_cast<const uint8_t*>(&used_idx),
+                          sizeof(used_idx));
+}
+
+/*
+ * Drains every buffer the driver made available since the last notification
+ * and writes them to the host in a single operation. Buffers already copied
+ * are still written if a later one turns out to be bad.
+ */
+bool VirtioConsole::process_transmitq()
+{
+    VirtQueue& q = queues[TRANSMITQ];
+    if (!q.ready || q.num == 0 || broken())
+        return true;
+
+    bool used = false;
+    uint16_t avail_idx = 0;
+    bool ok = load_avail_idx(q, avail_idx);
+    while (ok && q.last_avail_idx != avail_idx) {
+        uint16_t head = 0;
+        if (!load_avail_ring(q, q.last_avail_idx++, head)) {
+            ok = false;
+            break;
+        }
+        uint16_t i = head;
+        uint32_t chain_len = 0;
+
+        for (uint32_t n = 0; n < q.num; n++) {
+            VirtqDesc d {};
+            if (!load_desc(q, i, d) || !mmu->in_ram(d.addr, d.len)) {
+                ok = false;
+                break;
+            }
+            size_t old_size = tx_buffer.size();
+            tx_buffer.resize(old_size + d.len);
+            (void)mmu->dma_read(d.addr, reinterpret_cast<uint8_t*>(&tx_buffer[old_size]),
+                                d.len);
+            chain_len += d.len;
+            if ((d.flags & VIRTQ_DESC_F_NEXT) == 0)
+                break;
+            i = d.next;
+        }
+
+        if (!ok || !push_used(q, head, chain_len)) {
+            ok = false;
+            break;
+        }
+        used = true;
+    }
+
+    if (!tx_buffer.empty()) {
+        auto* data = reinterpret_cast<const uint8_t*>(tx_buffer.data());
+        write_output(data, tx_buffer.size());
+        tx_buffer.clear();
+    }
+
+    if (used) {
+        interrupt_status |= VIRTIO_INT_USED_RING;
+        raise_irq();
+    }
+    return ok;
+}
+
+/*
+ * Fills the guest-writable buffers posted on the receive queue with as much
+ * pending host input as they can hold.
+ */
+bool VirtioConsole::process_receiveq()
+{
+    VirtQueue& q = queues[RECEIVEQ];
+    if (!q.ready || q.num == 0 || rx_pending.empty() || broken())
+        return true;
+
+    bool used = false;
+    size_t consumed = 0;
+    uint16_t avail_idx = 0;
+    bool ok = load_avail_idx(q, avail_idx);
+    while (ok && q.last_avail_idx != avail_idx && consumed < rx_pending.size()) {
+        uint16_t head = 0;
+        if (!load_avail_ring(q, q.last_avail_idx++, head)) {
+            ok = false;
+            break;
+        }
+        uint16_t i = head;
+        uint32_t written = 0;
+
+        for (uint32_t n = 0; n < q.num && consumed < rx_pending.size(); n++) {
+            VirtqDesc d {};
+            if (!load_desc(q, i, d)) {
+                ok = false;
+                break;
+            }
+            if ((d.flags & VIRTQ_DESC_F_WRITE) != 0) {
+                auto len = std::min<uint64_t>(d.len, rx_pending.size() - consumed);
+                auto* src = reinterpret_cast<const uint8_t*>(&rx_pending[consumed]);
+                if (!mmu->dma_write(d.addr, src, len)) {
+                    ok = false;
+                    break;
+                }
+                consumed += len;
+                written += static_cast<uint32_t>(len);
+            }
+            if ((d.flags & VIRTQ_DESC_F_NEXT) == 0)
+                break;
+            i = d.next;
+        }
+
+        if (!ok || !push_used(q, head, written)) {
+            ok = false;
+            break;
+        }
+        used = true;
+    }
+
+    rx_pending.erase(0, consumed);
+
+    if (used) {
+        interrupt_status |= VIRTIO_INT_USED_RING;
+        raise_irq();
+    }
+    return ok;
+}
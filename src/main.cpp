@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <util.h>
+#include <Dictionary.h>
 #include <FuzzThread.h>
+#include <Minimizer.h>
+#include <StatsReporter.h>
 #ifndef TEST_ENV
 #include <VEmu.h>
 #else
@@ -16,17 +26,164 @@ int main(int argc, const char* argv[])
 #ifdef TEST_ENV
     Tester::run();
 #elif defined(FUZZ_ENV)
+    static constexpr auto REPORT_INTERVAL = std::chrono::seconds(1);
+
+    const char* prog = argv[0];
+    uint64_t n_workers = std::max(1U, std::thread::hardware_concurrency());
+    uint64_t runs_per_worker = 100;
+    uint64_t insn_limit = 10'000'000;
+    std::string stats_path = "fuzzer_stats";
+    std::string crashes_dir = "crashes";
+    std::string persistent_fn;
+    std::string cmin_dir;
+    std::string tmin_dir;
+    bool use_coverage = true;
+    bool use_cmplog = false;
+    bool use_dictionary = true;
+    bool use_taint = false;
+    std::string output_mode = "discard";
+    while (argc > 1 && argv[1][0] == '-') {
+        std::string opt = argv[1];
+        if (argc > 2
+            && (opt == "-j" || opt == "-n" || opt == "-t" || opt == "--stats"
+                || opt == "--crashes" || opt == "--persistent" || opt == "--cmin"
+                || opt == "--tmin" || opt == "--output")) {
+            if (opt == "-j")
+                n_workers = std::max(1UL, std::stoul(argv[2]));
+            else if (opt == "-n")
+                runs_per_worker = std::stoul(argv[2]);
+            else if (opt == "-t")
+                insn_limit = std::max(1UL, std::stoul(argv[2]));
+            else if (opt == "--stats")
+                stats_path = argv[2];
+            else if (opt == "--crashes")
+                crashes_dir = argv[2];
+            else if (opt == "--persistent")
+                persistent_fn = argv[2];
+            else if (opt == "--cmin")
+                cmin_dir = argv[2];
+            else if (opt == "--output")
+                output_mode = argv[2];
+            else
+                tmin_dir = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if (opt == "--no-coverage") {
+            use_coverage = false;
+            argc--;
+            argv++;
+        } else if (opt == "--cmplog") {
+            use_cmplog = true;
+            argc--;
+            argv++;
+        } else if (opt == "--no-dict") {
+            use_dictionary = false;
+            argc--;
+            argv++;
+        } else if (opt == "--taint") {
+            use_taint = true;
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+    }
+
     if (argc < 4) {
-        std::cout << "Usage: " << argv[0]
-                  << " path/to/corpus/directory TARGET [OPTIONS...]";
+        std::cout << "Usage: " << prog
+                  << " [-j WORKERS] [-n RUNS_PER_WORKER] [-t INSN_LIMIT] [--stats FILE] "
+                     "[--crashes DIR] [--persistent FUNCTION|0xADDR] [--no-coverage] "
+                     "[--cmplog] [--no-dict] [--taint] [--output discard|host|capture] "
+                     "[--cmin OUT_DIR | --tmin OUT_DIR] "
+                     "path/to/corpus/directory TARGET [OPTIONS...]";
         exit(EXIT_FAILURE);
     }
 
     auto corpus = Corpus(argv[1]);
     auto* fuzz_info = read_elf(argv[2]);
     const char** fuzzed_cmd_args = &argv[3];
-    FuzzThread th1 { &corpus, fuzz_info, fuzzed_cmd_args, argc - 3 };
-    th1.dispatch(100);
+    SharedCoverage coverage;
+    Scheduler scheduler(&corpus);
+    CrashStore crashes(crashes_dir);
+
+    /* The minimization tools compare coverage, they need it regardless. */
+    bool minimize = !cmin_dir.empty() || !tmin_dir.empty();
+    FuzzConfig config;
+    config.coverage = use_coverage || minimize ? &coverage : nullptr;
+    config.insn_limit = insn_limit;
+    config.cmplog = use_cmplog;
+    config.taint = use_taint && !minimize;
+    if (output_mode == "host") {
+        config.output = FuzzConfig::Output::Host;
+    } else if (output_mode == "capture") {
+        config.output = FuzzConfig::Output::Capture;
+    } else if (output_mode != "discard") {
+        std::cout << "Unknown output mode: " << output_mode << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<std::string> dictionary;
+    if (use_dictionary && !minimize) {
+        dictionary = extract_dictionary(fuzz_info);
+        std::cout << "Dictionary: " << dictionary.size() << " tokens from " << argv[2]
+                  << std::endl;
+        config.dictionary = &dictionary;
+    }
+    config.scheduler = &scheduler;
+    config.crashes = minimize ? nullptr : &crashes;
+    if (!persistent_fn.empty()) {
+        config.persistent_addr = resolve_address(fuzz_info, persistent_fn);
+        if (config.persistent_addr == ~0ULL) {
+            std::cout << "Unknown function: " << persistent_fn << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::vector<std::unique_ptr<FuzzThread>> workers;
+    for (uint64_t i = 0; i < n_workers; i++) {
+        uint64_t seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        workers.push_back(std::make_unique<FuzzThread>(
+            &corpus, fuzz_info, fuzzed_cmd_args, argc - 3, seed, config));
+    }
+
+    if (minimize) {
+        Minimizer minimizer(&corpus, workers);
+        if (!cmin_dir.empty())
+            minimizer.cmin(cmin_dir);
+        else
+            minimizer.tmin(tmin_dir);
+        return EXIT_SUCCESS;
+    }
+
+    StatsReporter reporter(stats_path, &corpus, &coverage, &crashes);
+    for (const auto& worker : workers)
+        reporter.add_worker(&worker->get_stats());
+
+    std::mutex done_lock;
+    std::condition_variable done_cv;
+    uint64_t n_done = 0;
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&]() {
+            worker->dispatch(runs_per_worker);
+            std::lock_guard<std::mutex> lock(done_lock);
+            n_done++;
+            done_cv.notify_one();
+        });
+    }
+
+    /* The main thread only reports, the workers never wait on it. */
+    {
+        std::unique_lock<std::mutex> lock(done_lock);
+        while (!done_cv.wait_for(lock, REPORT_INTERVAL,
+                                 [&]() { return n_done == n_workers; })) {
+            lock.unlock();
+            reporter.report();
+            lock.lock();
+        }
+    }
+    for (auto& th : threads)
+        th.join();
+    reporter.report();
 #else
 #error "General emulation still WIP."
 #endif
@@ -1,11 +1,29 @@
-#include <filesystem>
-#include <map>
 #include <util.h>
 
-static elfio reader;
+static void read_functions(elfio& reader, FileInfo* info)
+{
+    for (const auto& psec : reader.sections) {
+        if (psec->get_type() != SHT_SYMTAB)
+            continue;
+        symbol_section_accessor symbols(reader, &*psec);
+        for (Elf_Xword i = 0; i < symbols.get_symbols_num(); i++) {
+            std::string name;
+            Elf64_Addr value;
+            Elf_Xword size;
+            unsigned char bind;
+            unsigned char type;
+            Elf_Half section_index;
+            unsigned char other;
+            symbols.get_symbol(i, name, value, size, bind, type, section_index, other);
+            if (type == STT_FUNC && !name.empty())
+                info->functions.emplace(name, value);
+        }
+    }
+}
 
 FileInfo* read_elf(const std::string& fname, bool exit_fatally)
 {
+    elfio reader;
     if (!reader.load(fname.c_str())) {
         std::cout << "Can't find or process ELF file: " << fname << std::endl;
         if (exit_fatally)
@@ -25,7 +43,19 @@ FileInfo* read_elf(const std::string& fname, bool exit_fatally)
                                            pseg->get_memory_size(), pseg->get_file_size(),
                                            dat });
     }
-    return new FileInfo { fname, segments, reader.get_entry() };
+    auto* info = new FileInfo { fname, segments, reader.get_entry() };
+    read_functions(reader, info);
+    info->main_addr = resolve_address(info, "main");
+    return info;
+}
+
+uint64_t resolve_address(const FileInfo* info, const std::string& spec)
+{
+    if (spec.rfind("0x", 0) == 0)
+        return std::stoull(spec, nullptr, 16);
+
+    auto it = info->functions.find(spec);
+    return it != info->functions.end() ? it->second : ~0ULL;
 }
 
 std::vector<char*> substitute_input(const char** args, size_t len, const char* input_name)
@@ -43,7 +73,15 @@ std::vector<char*> substitute_input(const char** args, size_t len, const char* i
 }
 
 
-static uint64_t seed = 123456789;
+/* Every thread runs its own generator, seeded through seed_rand(). */
+static thread_local uint64_t seed = 123456789;
+
+void seed_rand(uint64_t s)
+{
+    /* xorshift gets stuck on a zero state. */
+    seed = s != 0 ? s : 123456789;
+}
+
 uint64_t gen_rand()
 {
     uint64_t x = seed;
@@ -53,43 +91,3 @@ uint64_t gen_rand()
     seed = x;
     return x * 0x2545F4914F6CDD1Dull;
 }
-
-Corpus::Corpus(const std::string& dir_path)
-{
-    for (const auto& entry : std::filesystem::directory_iterator(dir_path))
-        corpus_files.push_back(read_elf(entry.path(), true));
-}
-
-FileInfo* Corpus::get_random_free_file()
-{
-    while (true) {
-        auto idx = gen_rand() % corpus_files.size();
-        auto& f = corpus_files[idx];
-        if (f->lock.try_lock())
-            return f;
-    }
-}
-
-using MutationHistory = std::map<std::pair<uint64_t, uint64_t>, uint8_t>;
-
-void push_mutate(FileInfo* info, uint64_t n_bytes, MutationHistory& history)
-{
-    while (n_bytes--) {
-        uint64_t seg_idx = gen_rand() % info->segments.size();
-        uint64_t byte_idx = gen_rand() % info->segments[seg_idx].file_size;
-        if (history.find({ seg_idx, byte_idx }) == std::end(history)) {
-            history[{ seg_idx, byte_idx }] = info->segments[seg_idx].data[byte_idx];
-        }
-
-        info->segments[seg_idx].data[byte_idx] = (uint8_t)(gen_rand() % 255);
-    }
-}
-
-void pop_mutate(FileInfo* info, const MutationHistory& history)
-{
-    for (auto it = std::begin(history); it != std::end(history); it++) {
-        auto pos = (*it).first;
-        auto byte_val = (*it).second;
-        info->segments[pos.first].data[pos.second] = byte_val;
-    }
-}